@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <array>
 #include <random>
 #include <string>
 
@@ -86,3 +88,75 @@ static inline std::string gen_src(std::size_t len, std::size_t seed = 42) {
   output += '\0';
   return output;
 }
+
+// shape of the source generated by gen_forms
+struct gen_options {
+  std::size_t max_depth = 4; // lists nested in a top level form
+  std::size_t fan_out = 4;   // elements per list
+  // relative weights of the atoms: identifiers, integers, decimals, strings
+  std::array<double, 4> literal_mix = {4, 2, 1, 1};
+  // expected number of nested lists per list while below max_depth, above 1
+  // the size of a form grows exponentially with depth
+  double nested_lists = 1.5;
+};
+
+namespace {
+std::string gen_string(std::mt19937& rng) {
+  auto length = std::uniform_int_distribution<std::size_t>(0, 32)(rng);
+  std::string str = "\"";
+  std::uniform_int_distribution<char> dist('a', 'z');
+  for (std::size_t i = 0; i < length; ++i) {
+    str += dist(rng);
+  }
+  return str + "\"";
+}
+
+void gen_form(std::string& out, std::mt19937& rng, const gen_options& opts,
+              std::size_t depth) {
+  auto atom = std::discrete_distribution<int>(opts.literal_mix.begin(),
+                                              opts.literal_mix.end());
+  auto nested = std::bernoulli_distribution(std::min(
+      1.0, opts.nested_lists / static_cast<double>(opts.fan_out)));
+
+  if (depth == opts.max_depth || (depth != 0 && !nested(rng))) {
+    switch (atom(rng)) {
+    case 0:
+      out += gen_ident(rng);
+      break;
+    case 1:
+      out += gen_num(rng);
+      break;
+    case 2:
+      out += gen_decimal(rng);
+      break;
+    default:
+      out += gen_string(rng);
+      out += ' ';
+    }
+    return;
+  }
+
+  out += '(';
+  for (std::size_t i = 0; i != opts.fan_out; ++i) {
+    gen_form(out, rng, opts, depth + 1);
+  }
+  out += ")\n";
+}
+} // namespace
+
+// well formed top level forms of roughly len characters, '\0' terminated
+static inline std::string gen_forms(std::size_t len,
+                                    const gen_options& opts = {},
+                                    std::size_t seed = 42) {
+  std::mt19937 rng(seed);
+
+  std::string output;
+  output.reserve(len + 1);
+
+  while (output.size() < len) {
+    gen_form(output, rng, opts, 0);
+  }
+
+  output += '\0';
+  return output;
+}
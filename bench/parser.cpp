@@ -0,0 +1,155 @@
+#include <benchmark/benchmark.h>
+
+#include <ely/arena/growing.hpp>
+#include <ely/green/list.hpp>
+#include <ely/green/parser.hpp>
+#include <ely/interner.hpp>
+#include <ely/stx/token.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "gen_src.hpp"
+
+// count every heap allocation, arenas only show up once per block
+namespace {
+std::atomic<std::size_t> allocations{0};
+std::atomic<std::size_t> allocated_bytes{0};
+} // namespace
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* p = std::malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static constexpr auto MiB = 1024 * 1024;
+
+namespace {
+std::size_t count_nodes(const ely::green::list& l) {
+  std::size_t res = 1;
+  for (const auto& child : l) {
+    if (const auto* cl = child.as_list()) {
+      res += count_nodes(*cl);
+    } else {
+      ++res;
+    }
+  }
+  return res;
+}
+
+// literal mixes selected by the third benchmark argument
+constexpr std::array<std::array<double, 4>, 4> mixes = {{
+    {4, 2, 1, 1}, // mostly identifiers
+    {1, 4, 4, 0}, // numeric
+    {1, 0, 0, 4}, // strings
+    {1, 1, 1, 1}, // even
+}};
+
+gen_options options(const benchmark::State& state) {
+  return gen_options{
+      .max_depth = static_cast<std::size_t>(state.range(0)),
+      .fan_out = static_cast<std::size_t>(state.range(1)),
+      .literal_mix = mixes[static_cast<std::size_t>(state.range(2))],
+  };
+}
+
+double peak_rss_mib() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_maxrss) / 1024.0;
+}
+
+void report(benchmark::State& state, std::size_t src_size, std::size_t nodes,
+            std::size_t allocs, std::size_t bytes) {
+  auto iterations = static_cast<double>(state.iterations());
+  state.SetBytesProcessed(static_cast<std::int64_t>(src_size) *
+                          state.iterations());
+  state.SetItemsProcessed(static_cast<std::int64_t>(nodes) *
+                          state.iterations());
+  state.counters["nodes"] = static_cast<double>(nodes);
+  state.counters["allocs_per_node"] =
+      static_cast<double>(allocs) / iterations / static_cast<double>(nodes);
+  state.counters["bytes_per_node"] =
+      static_cast<double>(bytes) / iterations / static_cast<double>(nodes);
+  state.counters["peak_rss_mib"] = peak_rss_mib();
+}
+} // namespace
+
+// token to tree only, the source is lexed up front
+static void BM_parse_tokens(benchmark::State& state) {
+  auto src = gen_forms(MiB, options(state));
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+
+  std::size_t nodes = 0;
+  {
+    auto arena = ely::arena::growing{};
+    nodes = count_nodes(
+        ely::green::parser(src, tokens, interner, arena).parse_file());
+  }
+
+  auto allocs_before = allocations.load();
+  auto bytes_before = allocated_bytes.load();
+  for (auto _ : state) {
+    auto arena = ely::arena::growing{};
+    auto root = ely::green::parser(src, tokens, interner, arena).parse_file();
+    benchmark::DoNotOptimize(root);
+  }
+
+  report(state, src.size(), nodes, allocations.load() - allocs_before,
+         allocated_bytes.load() - bytes_before);
+}
+
+// lexing, decoding and parsing
+static void BM_parse_end_to_end(benchmark::State& state) {
+  auto src = gen_forms(MiB, options(state));
+  auto interner = ely::simple_interner{};
+
+  std::size_t nodes = 0;
+  {
+    auto tokens = ely::stx::tokenize(src);
+    auto arena = ely::arena::growing{};
+    nodes = count_nodes(
+        ely::green::parser(src, tokens, interner, arena).parse_file());
+  }
+
+  auto allocs_before = allocations.load();
+  auto bytes_before = allocated_bytes.load();
+  for (auto _ : state) {
+    auto tokens = ely::stx::tokenize(src);
+    auto arena = ely::arena::growing{};
+    auto root = ely::green::parser(src, tokens, interner, arena).parse_file();
+    benchmark::DoNotOptimize(root);
+  }
+
+  report(state, src.size(), nodes, allocations.load() - allocs_before,
+         allocated_bytes.load() - bytes_before);
+}
+
+// depth, fan-out, literal mix
+static void shapes(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"depth", "fan_out", "mix"});
+  for (int depth : {1, 4, 16}) {
+    for (int fan_out : {2, 8, 32}) {
+      b->Args({depth, fan_out, 0});
+    }
+  }
+  for (int mix = 1; mix != static_cast<int>(mixes.size()); ++mix) {
+    b->Args({4, 8, mix});
+  }
+}
+
+BENCHMARK(BM_parse_tokens)->Apply(shapes);
+BENCHMARK(BM_parse_end_to_end)->Apply(shapes);
+
+BENCHMARK_MAIN();
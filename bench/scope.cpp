@@ -0,0 +1,197 @@
+#include <benchmark/benchmark.h>
+
+#include <ely/concurrent_binding_map.hpp>
+#include <ely/scope.hpp>
+
+#include <expected>
+#include <vector>
+
+// scope set implementations are compared on sets of state.range(0) scopes,
+// identifiers usually only carry a few
+namespace {
+std::vector<ely::scope> make_scopes(std::size_t n) {
+  auto gen = ely::scope_generator();
+  std::vector<ely::scope> res;
+  for (std::size_t i = 0; i != n; ++i) {
+    res.push_back(gen());
+  }
+  return res;
+}
+
+template <typename SS> SS make_set(std::span<const ely::scope> scopes) {
+  auto res = SS();
+  for (auto sc : scopes) {
+    res = res.add_scope(sc);
+  }
+  return res;
+}
+} // namespace
+
+template <typename SS> static void BM_add_scope(benchmark::State& state) {
+  auto scopes = make_scopes(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    auto ss = make_set<SS>(scopes);
+    benchmark::DoNotOptimize(ss);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename SS> static void BM_flip_scope(benchmark::State& state) {
+  auto scopes = make_scopes(static_cast<std::size_t>(state.range(0)) + 1);
+  auto ss = make_set<SS>(std::span(scopes).first(scopes.size() - 1));
+  auto extra = scopes.back();
+  for (auto _ : state) {
+    auto flipped = ss.flip_scope(extra);
+    benchmark::DoNotOptimize(flipped);
+  }
+}
+
+template <typename SS> static void BM_has_scope(benchmark::State& state) {
+  auto scopes = make_scopes(static_cast<std::size_t>(state.range(0)));
+  auto ss = make_set<SS>(scopes);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ss.has_scope(scopes[i]));
+    i = (i + 1) % scopes.size();
+  }
+}
+
+// the check binding lookup does for every candidate binding
+template <typename SS> static void BM_subset_of(benchmark::State& state) {
+  auto scopes = make_scopes(static_cast<std::size_t>(state.range(0)));
+  auto super = make_set<SS>(scopes);
+  auto sub = super.remove_scope(scopes[scopes.size() / 2]);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sub.subset_of(super));
+  }
+}
+
+template <typename SS> static void BM_copy(benchmark::State& state) {
+  auto scopes = make_scopes(static_cast<std::size_t>(state.range(0)));
+  auto ss = make_set<SS>(scopes);
+  for (auto _ : state) {
+    auto copy = ss;
+    benchmark::DoNotOptimize(copy);
+  }
+}
+
+static void sizes(benchmark::internal::Benchmark* b) {
+  b->ArgName("scopes");
+  for (int n : {1, 2, 4, 8, 32}) {
+    b->Arg(n);
+  }
+}
+
+namespace {
+constexpr unsigned symbol_count = 1024;
+using concurrent_map = ely::concurrent_binding_map<unsigned, unsigned>;
+
+// every symbol bound in each of the growing sets of scopes
+const concurrent_map& shared_map(std::span<const ely::scope> scopes) {
+  static const auto& bm = [&]() -> const concurrent_map& {
+    static concurrent_map res;
+    auto ss = ely::scope_set();
+    for (auto sc : scopes) {
+      ss = ss.add_scope(sc);
+      for (unsigned sym = 0; sym != symbol_count; ++sym) {
+        res.insert(sym, ss, sym);
+      }
+    }
+    return res;
+  }();
+  return bm;
+}
+} // namespace
+
+namespace {
+struct interned_identifier {
+  ely::symbol sym;
+  ely::scope_set ss;
+
+  auto symbol() const { return sym; }
+  const auto& scope_set() const { return ss; }
+};
+
+using form_map = ely::binding_map<interned_identifier, unsigned>;
+using form_result =
+    std::expected<form_map::value_type, ely::lookup_error>;
+
+// a body of state.range(0) occurrences of 16 names, half of them shadowed
+// by an inner scope
+struct form {
+  form_map bm;
+  std::vector<interned_identifier> ids;
+  std::vector<ely::scope_set_handle> handles;
+  std::vector<form_result> out;
+
+  explicit form(std::size_t occurrences) {
+    constexpr unsigned names = 16;
+    auto table = ely::scope_set_table();
+    auto scopes = make_scopes(2);
+    auto outer = make_set<ely::scope_set>(std::span(scopes).first(1));
+    auto inner = make_set<ely::scope_set>(scopes);
+    for (unsigned n = 0; n != names; ++n) {
+      bm.insert(interned_identifier{ely::symbol{n * 37}, outer}, n);
+      if (n % 2 == 0) {
+        bm.insert(interned_identifier{ely::symbol{n * 37}, inner}, n + names);
+      }
+    }
+    for (std::size_t i = 0; i != occurrences; ++i) {
+      ids.push_back(interned_identifier{
+          ely::symbol{static_cast<unsigned>(i * 7 % names) * 37}, inner});
+      handles.push_back(table.make(scopes));
+    }
+    out.resize(occurrences, std::unexpected(ely::lookup_error::key_not_found));
+  }
+};
+} // namespace
+
+static void BM_lookup_each(benchmark::State& state) {
+  auto f = form(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    for (std::size_t i = 0; i != f.ids.size(); ++i) {
+      f.out[i] = f.bm.lookup(f.ids[i]);
+    }
+    benchmark::DoNotOptimize(f.out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_resolve_all(benchmark::State& state) {
+  auto f = form(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    f.bm.resolve_all(f.ids, f.handles, f.out);
+    benchmark::DoNotOptimize(f.out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// lookups from state.threads() expanders sharing one map, they never wait on
+// each other so the throughput should grow with the threads
+static void BM_concurrent_lookup(benchmark::State& state) {
+  auto scopes = make_scopes(4);
+  const auto& bm = shared_map(scopes);
+  auto ss = make_set<ely::scope_set>(scopes);
+  auto sym = static_cast<unsigned>(state.thread_index()) * 97;
+  for (auto _ : state) {
+    sym = (sym + 1) % symbol_count;
+    benchmark::DoNotOptimize(bm.lookup(sym, ss));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_add_scope, ely::tree_scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_add_scope, ely::scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_flip_scope, ely::tree_scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_flip_scope, ely::scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_has_scope, ely::tree_scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_has_scope, ely::scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_subset_of, ely::tree_scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_subset_of, ely::scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_copy, ely::tree_scope_set)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_copy, ely::scope_set)->Apply(sizes);
+BENCHMARK(BM_lookup_each)->Arg(64)->Arg(1024);
+BENCHMARK(BM_resolve_all)->Arg(64)->Arg(1024);
+BENCHMARK(BM_concurrent_lookup)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -19,12 +19,23 @@ struct block {
   // offset 16 bytes, correct for max_align_t
   alignas(alignof(std::max_align_t)) std::byte data[];
 };
+} // namespace detail
+
+// position in an arena, everything allocated after it can be released at once
+struct marker {
+  detail::block* block{};
+  std::byte* ptr{};
+  std::size_t count{}; // allocations made before, for the constexpr arena
+};
+
+namespace detail {
 
 template <typename GrowthFn> class basic_arena_impl {
 private:
-  std::byte* cur_ptr_;
-  std::byte* end_ptr_;
-  block* current_block_;
+  std::byte* cur_ptr_{};
+  std::byte* end_ptr_{};
+  block* current_block_{};
+  block* spare_{}; // most recently released block, reused before growing
   [[no_unique_address]] GrowthFn growth_fn_;
 
 public:
@@ -34,10 +45,12 @@ public:
   ~basic_arena_impl() {
     while (current_block_) {
       detail::block* prev = current_block_->prev;
-      ::operator delete(current_block_,
-                        sizeof(detail::block) + current_block_->capacity);
+      free_block(current_block_);
       current_block_ = prev;
     }
+    if (spare_) {
+      free_block(spare_);
+    }
   }
 
   std::byte* allocate_bytes(std::size_t size,
@@ -59,9 +72,49 @@ public:
     return reinterpret_cast<T*>(allocate_bytes(sizeof(T) * count, alignof(T)));
   }
 
+  marker mark() const { return marker{current_block_, cur_ptr_}; }
+
+  // frees everything allocated since m was taken, the largest freed block is
+  // kept to serve the next allocations so repeatedly filling and releasing a
+  // region doesn't go back to the system allocator.
+  void release(const marker& m) {
+    while (current_block_ != m.block) {
+      assert(current_block_ && "marker doesn't belong to this arena");
+      detail::block* prev = current_block_->prev;
+      if (!spare_ || spare_->capacity < current_block_->capacity) {
+        std::swap(spare_, current_block_);
+      }
+      if (current_block_) {
+        free_block(current_block_);
+      }
+      current_block_ = prev;
+    }
+
+    cur_ptr_ = m.ptr;
+    end_ptr_ = current_block_
+                   ? current_block_->data + current_block_->capacity
+                   : nullptr;
+  }
+
 private:
+  static void free_block(detail::block* b) {
+    ::operator delete(b, sizeof(detail::block) + b->capacity);
+  }
+
   ELY_NOINLINE ELY_COLD void allocate_block(std::size_t size,
                                             std::size_t alignment) {
+    if (spare_) {
+      void* p = spare_->data;
+      std::size_t space = spare_->capacity;
+      if (std::align(alignment, size, p, space)) {
+        spare_->prev = current_block_;
+        current_block_ = std::exchange(spare_, nullptr);
+        cur_ptr_ = static_cast<std::byte*>(p);
+        end_ptr_ = current_block_->data + current_block_->capacity;
+        return;
+      }
+    }
+
     std::size_t block_size = growth_fn_(size);
     assert(block_size > size && "growth function must return a size larger "
                                 "than the requested allocation");
@@ -105,6 +158,36 @@ public:
     return impl_.visit(
         [count](auto& arena) { return arena.template allocate<T>(count); });
   }
+
+  constexpr marker mark() const {
+    return impl_.visit(
+        [](const ely::arena::constexpr_& arena) {
+          return marker{.count = arena.mark()};
+        },
+        [](const auto& arena) { return arena.mark(); });
+  }
+
+  // frees everything allocated after m was taken
+  constexpr void release(const marker& m) {
+    impl_.visit(
+        [&](ely::arena::constexpr_& arena) { arena.release(m.count); },
+        [&](auto& arena) { arena.release(m); });
+  }
+};
+
+// releases everything allocated in an arena during its lifetime
+template <typename Arena> class region {
+  Arena* arena_;
+  marker mark_;
+
+public:
+  explicit constexpr region(Arena& arena)
+      : arena_(std::addressof(arena)), mark_(arena.mark()) {}
+
+  region(const region&) = delete;
+  region& operator=(const region&) = delete;
+
+  constexpr ~region() { arena_->release(mark_); }
 };
 } // namespace arena
 } // namespace ely
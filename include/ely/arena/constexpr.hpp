@@ -83,6 +83,14 @@ public:
     allocations_.clear();
   }
 
+  constexpr std::size_t mark() const { return allocations_.size(); }
+
+  constexpr void release(std::size_t mark) {
+    check_consteval();
+    assert(mark <= allocations_.size());
+    allocations_.erase(allocations_.begin() + mark, allocations_.end());
+  }
+
 private:
   constexpr void check_consteval() const {
     assert(std::is_constant_evaluated() &&
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+#include "ely/scope.hpp"
+#include "ely/util/hamt.hpp"
+
+namespace ely {
+// bindings of symbols by the interned scope set of the binding identifier,
+// resolved like binding_map. The environment is persistent: copying it is an
+// O(1) snapshot sharing everything with the original, inserting into one copy
+// leaves the others alone, and restoring a snapshot is assigning it back.
+// Inserting copies the path to the symbol and its bindings, so snapshots
+// taken between inserts only cost memory for what changed.
+// Everything is allocated in arena, which has to outlive every snapshot.
+// Releasing the arena to a marker taken before a speculative expansion frees
+// the snapshots made during it.
+template <typename Symbol, typename V, typename Arena,
+          typename Hash = std::hash<Symbol>>
+class binding_env {
+  static_assert(std::is_trivially_destructible_v<V>,
+                "bindings are released with their arena");
+
+public:
+  struct binding {
+    scope_set_handle ss;
+    std::uint64_t signature;
+    V value;
+  };
+
+private:
+  Arena* arena_;
+  // the bindings of a symbol sorted by the size of their scope set,
+  // descending
+  ely::hamt<Symbol, std::span<const binding>, Hash> map_;
+
+public:
+  explicit binding_env(Arena& arena) : arena_(std::addressof(arena)) {}
+
+  // number of symbols with a binding
+  std::size_t size() const { return map_.size(); }
+
+  binding_env snapshot() const { return *this; }
+
+  // both environments share their state, not just equal bindings
+  bool is_same(const binding_env& other) const {
+    return map_.is_same(other.map_);
+  }
+
+  std::span<const binding> find_bindings(const Symbol& sym) const {
+    const auto* bindings = map_.find(sym);
+    return bindings ? *bindings : std::span<const binding>{};
+  }
+
+  // returns false and leaves the environment alone if sym is already bound
+  // with the same scope set
+  bool insert(const scope_set_table& table, const Symbol& sym,
+              scope_set_handle ss, const V& value) {
+    auto old = find_bindings(sym);
+    auto size = table.size(ss);
+    auto pos = std::ranges::partition_point(old, [&](const binding& b) {
+      return table.size(b.ss) >= size;
+    });
+    auto idx = static_cast<std::size_t>(pos - old.begin());
+
+    // bindings of the same size directly precede pos
+    for (auto it = pos; it != old.begin();) {
+      --it;
+      if (table.size(it->ss) != size) {
+        break;
+      }
+      if (it->ss == ss) {
+        return false;
+      }
+    }
+
+    auto* bindings = arena_->template allocate<binding>(old.size() + 1);
+    std::uninitialized_copy_n(old.begin(), idx, bindings);
+    std::construct_at(bindings + idx,
+                      binding{ss, detail::scope_signature(table.ids(ss)),
+                              value});
+    std::uninitialized_copy(pos, old.end(), bindings + idx + 1);
+    map_ = map_.insert(*arena_, sym,
+                       std::span<const binding>(bindings, old.size() + 1));
+    return true;
+  }
+
+  // the binding with the largest scope set that is a subset of ss, another
+  // match of the same size makes the lookup ambiguous
+  std::expected<V, lookup_error> lookup(const scope_set_table& table,
+                                        const Symbol& sym,
+                                        scope_set_handle ss) const {
+    auto bindings = find_bindings(sym);
+    if (bindings.empty()) {
+      return std::unexpected(lookup_error::key_not_found);
+    }
+
+    auto size = table.size(ss);
+    auto signature = detail::scope_signature(table.ids(ss));
+    auto matches = [&](const binding& b) {
+      return (b.signature & ~signature) == 0 && table.subset_of(b.ss, ss);
+    };
+
+    auto first = std::ranges::partition_point(
+        bindings, [&](const binding& b) { return table.size(b.ss) > size; });
+    for (auto it = first; it != bindings.end(); ++it) {
+      if (!matches(*it)) {
+        continue;
+      }
+      auto best = table.size(it->ss);
+      for (auto other = std::next(it);
+           other != bindings.end() && table.size(other->ss) == best;
+           ++other) {
+        if (matches(*other)) {
+          return std::unexpected(lookup_error::ambiguous);
+        }
+      }
+      return it->value;
+    }
+    return std::unexpected(lookup_error::scope_not_found);
+  }
+};
+} // namespace ely
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "ely/arena/growing.hpp"
+#include "ely/scope.hpp"
+#include "ely/util/hamt.hpp"
+#include "ely/util/sorted_set.hpp"
+
+namespace ely {
+// a binding map shared by threads expanding forms in parallel, resolved like
+// binding_map. Symbols are spread over shards, every shard publishes an
+// immutable hamt from symbols to their bindings through an atomic pointer.
+// Lookups take no locks, they register with their shard, load that pointer and
+// walk immutable nodes. They are lock-free but not wait-free, registering is
+// retried when a compaction starts at the same moment. Inserts lock their
+// shard, build the new version next to the old one and publish it.
+// Every insert costs the path to its symbol and a copy of the symbol's
+// bindings, which suits bindings being added rarely and looked up all the
+// time. Replaced versions stay in the shard's arena until the shard has seen
+// as many inserts as it has symbols, then the live bindings are copied into a
+// fresh arena and the old one is freed once the lookups which might still see
+// it have left. A shard therefore never holds more than a constant factor of
+// garbage over its live bindings. The insert compacting it waits for those
+// lookups after unlocking the shard, so other inserts carry on meanwhile.
+template <typename Symbol, typename V, typename Hash = std::hash<Symbol>>
+class concurrent_binding_map {
+  static_assert(std::is_trivially_destructible_v<V>,
+                "bindings are released with their shard");
+
+public:
+  struct binding {
+    std::span<const scope> scopes; // sorted by id
+    std::uint64_t signature;
+    V value;
+  };
+
+private:
+  static constexpr std::size_t shard_count = 16;
+  // fewer inserts than this never compact a shard
+  static constexpr std::size_t min_compaction = 64;
+
+  // bindings of a symbol sorted by the size of their scope set, descending
+  using map_type = ely::hamt<Symbol, std::span<const binding>, Hash>;
+
+  // on their own cache lines, so inserting into one doesn't slow down readers
+  // of the others
+  struct alignas(64) shard {
+    std::atomic<const map_type*> map{nullptr};
+    // lookups in progress by the parity of the epoch they started in. A
+    // compaction starts a new epoch and waits for the lookups of the previous
+    // one, which are the only ones that might have seen the old arena.
+    std::atomic<std::uint32_t> epoch{0};
+    mutable std::atomic<std::uint32_t> readers[2]{};
+    std::mutex mutex;        // held by inserts
+    std::mutex retire_mutex; // held while an old arena drains
+    std::unique_ptr<ely::arena::growing> arena =
+        std::make_unique<ely::arena::growing>(4096);
+    std::size_t inserts = 0; // since the last compaction
+  };
+
+  // keeps the versions of a shard a lookup might see alive
+  class read_guard {
+    const shard* shard_;
+    std::uint32_t parity_;
+
+  public:
+    explicit read_guard(const shard& s) : shard_(std::addressof(s)) {
+      while (true) {
+        auto epoch = s.epoch.load();
+        parity_ = epoch & 1;
+        s.readers[parity_].fetch_add(1);
+        // a compaction which started in between might not wait for us
+        if (s.epoch.load() == epoch) {
+          return;
+        }
+        s.readers[parity_].fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    read_guard(const read_guard&) = delete;
+    read_guard& operator=(const read_guard&) = delete;
+
+    ~read_guard() {
+      shard_->readers[parity_].fetch_sub(1, std::memory_order_release);
+    }
+  };
+
+  std::array<shard, shard_count> shards_;
+
+public:
+  concurrent_binding_map() = default;
+
+  concurrent_binding_map(const concurrent_binding_map&) = delete;
+  concurrent_binding_map& operator=(const concurrent_binding_map&) = delete;
+
+  // returns false and leaves the map alone if sym is already bound with the
+  // same scope set
+  bool insert(const Symbol& sym, const scope_set& ss, const V& value) {
+    auto& s = shard_of(sym);
+    std::unique_lock lock(s.mutex);
+    const map_type* map = s.map.load(std::memory_order_relaxed);
+
+    auto old = std::span<const binding>{};
+    if (map) {
+      if (const auto* bindings = map->find(sym)) {
+        old = *bindings;
+      }
+    }
+
+    auto size = ss.size();
+    auto pos = std::ranges::partition_point(
+        old, [&](const binding& b) { return b.scopes.size() >= size; });
+    auto idx = static_cast<std::size_t>(pos - old.begin());
+
+    // bindings of the same size directly precede pos
+    for (auto it = pos; it != old.begin();) {
+      --it;
+      if (it->scopes.size() != size) {
+        break;
+      }
+      if (std::ranges::equal(it->scopes, ss)) {
+        return false;
+      }
+    }
+
+    auto& arena = *s.arena;
+    auto* scopes = arena.template allocate<scope>(size);
+    std::ranges::copy(ss, scopes);
+    auto* bindings = arena.template allocate<binding>(old.size() + 1);
+    std::uninitialized_copy_n(old.begin(), idx, bindings);
+    std::construct_at(bindings + idx,
+                      binding{{scopes, size}, detail::scope_signature(ss),
+                              value});
+    std::uninitialized_copy(pos, old.end(), bindings + idx + 1);
+
+    auto next = (map ? *map : map_type{})
+                    .insert(arena, sym,
+                            std::span<const binding>(bindings,
+                                                     old.size() + 1));
+    publish(s, arena, next);
+
+    if (++s.inserts >= std::max(min_compaction, next.size())) {
+      auto old = compact(s, next);
+      lock.unlock();
+      retire(s, std::move(old));
+    }
+    return true;
+  }
+
+  // the binding with the largest scope set that is a subset of ss, another
+  // match of the same size makes the lookup ambiguous
+  std::expected<V, lookup_error> lookup(const Symbol& sym,
+                                        const scope_set& ss) const {
+    const auto& s = shard_of(sym);
+    auto guard = read_guard(s);
+    auto bindings = find_bindings(s, sym);
+    if (bindings.empty()) {
+      return std::unexpected(lookup_error::key_not_found);
+    }
+
+    auto signature = detail::scope_signature(ss);
+    auto matches = [&](const binding& b) {
+      return (b.signature & ~signature) == 0 &&
+             sorted_set::includes(ss.scopes(), b.scopes);
+    };
+
+    auto first = std::ranges::partition_point(bindings, [&](const binding& b) {
+      return b.scopes.size() > ss.size();
+    });
+    for (auto it = first; it != bindings.end(); ++it) {
+      if (!matches(*it)) {
+        continue;
+      }
+      auto best = it->scopes.size();
+      for (auto other = std::next(it);
+           other != bindings.end() && other->scopes.size() == best; ++other) {
+        if (matches(*other)) {
+          return std::unexpected(lookup_error::ambiguous);
+        }
+      }
+      return it->value;
+    }
+    return std::unexpected(lookup_error::scope_not_found);
+  }
+
+private:
+  // only valid while a read_guard of s is alive
+  static std::span<const binding> find_bindings(const shard& s,
+                                                const Symbol& sym) {
+    const map_type* map = s.map.load(std::memory_order_acquire);
+    if (!map) {
+      return {};
+    }
+    const auto* bindings = map->find(sym);
+    return bindings ? *bindings : std::span<const binding>{};
+  }
+
+  static void publish(shard& s, ely::arena::growing& arena,
+                      const map_type& map) {
+    auto* published = arena.template allocate<map_type>();
+    std::construct_at(published, map);
+    s.map.store(published, std::memory_order_release);
+  }
+
+  // copies the live bindings of s into a fresh arena, returns the old one
+  [[nodiscard]] static std::unique_ptr<ely::arena::growing>
+  compact(shard& s, const map_type& map) {
+    auto arena = std::make_unique<ely::arena::growing>(4096);
+    auto copy = map_type{};
+    map.for_each([&](const Symbol& sym, std::span<const binding> bindings) {
+      auto* out = arena->template allocate<binding>(bindings.size());
+      for (std::size_t i = 0; i != bindings.size(); ++i) {
+        const auto& b = bindings[i];
+        auto* scopes = arena->template allocate<scope>(b.scopes.size());
+        std::ranges::copy(b.scopes, scopes);
+        std::construct_at(out + i, binding{{scopes, b.scopes.size()},
+                                           b.signature, b.value});
+      }
+      copy = copy.insert(*arena, sym,
+                         std::span<const binding>(out, bindings.size()));
+    });
+    publish(s, *arena, copy);
+    s.inserts = 0;
+    return std::exchange(s.arena, std::move(arena));
+  }
+
+  // frees an arena replaced by compact once the lookups which might still see
+  // it have left. Retiring runs one at a time, so the lookups older than the
+  // previous retirement have left already and only the current epoch's
+  // lookups can see old.
+  static void retire(shard& s, std::unique_ptr<ely::arena::growing> old) {
+    std::lock_guard lock(s.retire_mutex);
+    // lookups starting from now on only see the copy, wait for the ones which
+    // started before
+    auto epoch = s.epoch.load(std::memory_order_relaxed);
+    s.epoch.store(epoch + 1);
+    while (s.readers[epoch & 1].load() != 0) {
+      std::this_thread::yield();
+    }
+    old.reset();
+  }
+
+  // the top bits pick the shard, the hamt uses the low ones
+  shard& shard_of(const Symbol& sym) {
+    auto h = detail::mix_hash(static_cast<std::uint64_t>(Hash{}(sym)));
+    return shards_[h >> 60];
+  }
+
+  const shard& shard_of(const Symbol& sym) const {
+    return const_cast<concurrent_binding_map&>(*this).shard_of(sym);
+  }
+};
+} // namespace ely
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "ely/stx/token.hpp"
+#include "ely/stx/tokens.hpp"
+
+namespace ely {
+namespace green {
+// delimiter structure of a token stream, computed without building a tree.
+// Any closing delimiter closes the innermost open list, as in parser.
+struct bracket_table {
+  static constexpr std::uint32_t no_match =
+      std::numeric_limits<std::uint32_t>::max();
+
+  // number of lists enclosing every token, delimiters belong to the enclosing
+  // list
+  std::vector<std::uint32_t> depth;
+  // opening delimiter: its closing delimiter, eof for unterminated lists
+  // closing delimiter: its opening delimiter, no_match for stray ones
+  // other tokens: no_match
+  std::vector<std::uint32_t> match;
+
+  std::vector<std::uint32_t> unclosed;   // opening delimiters without a match
+  std::vector<std::uint32_t> stray;      // closing delimiters without a match
+  std::vector<std::uint32_t> mismatched; // closing a different kind of list
+
+  constexpr bool balanced() const {
+    return unclosed.empty() && stray.empty() && mismatched.empty();
+  }
+};
+
+namespace detail {
+constexpr bool is_prefix(stx::token_kind tk) {
+  switch (tk) {
+  case stx::token_kind::quote:
+  case stx::token_kind::quasiquote:
+  case stx::token_kind::unquote:
+  case stx::token_kind::unquote_splicing:
+  case stx::token_kind::syntax:
+  case stx::token_kind::quasisyntax:
+  case stx::token_kind::unsyntax:
+  case stx::token_kind::unsyntax_splicing:
+    return true;
+  default:
+    return false;
+  }
+}
+
+constexpr int depth_delta(stx::token_kind tk) {
+  switch (tk) {
+  case stx::token_kind::lparen:
+  case stx::token_kind::lbracket:
+  case stx::token_kind::lbrace:
+    return 1;
+  case stx::token_kind::rparen:
+  case stx::token_kind::rbracket:
+  case stx::token_kind::rbrace:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+constexpr stx::token_kind closer_for(stx::token_kind tk) {
+  switch (tk) {
+  case stx::token_kind::lparen:
+    return stx::token_kind::rparen;
+  case stx::token_kind::lbracket:
+    return stx::token_kind::rbracket;
+  case stx::token_kind::lbrace:
+    return stx::token_kind::rbrace;
+  default:
+    return tk;
+  }
+}
+
+// tokens per block, a block of 32 bit lanes fills one or two vector registers
+inline constexpr std::size_t bracket_lanes = 16;
+
+// inclusive Hillis-Steele scan over one block, the fixed size lane loops are
+// left to the compiler to turn into vector shuffles and adds or mins, unlike
+// the hand written kernels of sorted_set
+template <typename Op>
+constexpr void scan_lanes(std::int32_t (&lanes)[bracket_lanes], Op op) {
+  for (std::size_t shift = 1; shift < bracket_lanes; shift *= 2) {
+    std::int32_t prev[bracket_lanes];
+    std::copy(std::begin(lanes), std::end(lanes), prev);
+    for (std::size_t k = shift; k < bracket_lanes; ++k) {
+      lanes[k] = op(prev[k], prev[k - shift]);
+    }
+  }
+}
+
+// depth of every token from prefix sums of the +1/-1 delimiter deltas. The
+// effective depth is the raw sum minus its lowest value so far, which
+// discards stray closing delimiters.
+constexpr void bracket_depths(std::span<const stx::token> tokens,
+                              std::span<std::uint32_t> out) {
+  std::int32_t carry = 0; // raw depth before the block
+  std::int32_t low = 0;   // lowest raw depth before the block, at most 0
+
+  for (std::size_t base = 0; base < tokens.size(); base += bracket_lanes) {
+    auto count = std::min(bracket_lanes, tokens.size() - base);
+
+    std::int32_t sum[bracket_lanes]{};
+    std::int32_t opener[bracket_lanes]{};
+    for (std::size_t k = 0; k != count; ++k) {
+      sum[k] = depth_delta(tokens[base + k].kind);
+      opener[k] = sum[k] > 0;
+    }
+
+    scan_lanes(sum, [](std::int32_t a, std::int32_t b) { return a + b; });
+    for (auto& s : sum) {
+      s += carry;
+    }
+
+    std::int32_t min[bracket_lanes];
+    std::copy(std::begin(sum), std::end(sum), min);
+    scan_lanes(min,
+               [](std::int32_t a, std::int32_t b) { return std::min(a, b); });
+    for (auto& m : min) {
+      m = std::min(m, low);
+    }
+
+    for (std::size_t k = 0; k != count; ++k) {
+      out[base + k] = static_cast<std::uint32_t>(sum[k] - min[k] - opener[k]);
+    }
+
+    // lanes past count repeat the last token
+    carry = sum[bracket_lanes - 1];
+    low = min[bracket_lanes - 1];
+  }
+}
+} // namespace detail
+
+// tokens must be terminated by eof, as returned by stx::tokenize
+constexpr bracket_table match_brackets(std::span<const stx::token> tokens) {
+  bracket_table res;
+  res.depth.resize(tokens.size());
+  res.match.assign(tokens.size(), bracket_table::no_match);
+  detail::bracket_depths(tokens, res.depth);
+
+  // the delimiters grouped by depth in token order, a counting sort. Between
+  // an opening delimiter and its closing delimiter everything is deeper, so
+  // within a depth every matched pair is adjacent and matching only pairs up
+  // neighbours, without walking a stack of open lists.
+  std::vector<std::uint32_t> starts; // first slot of every depth, then end
+  std::size_t delimiters = 0;
+  for (std::size_t i = 0; i != tokens.size(); ++i) {
+    if (detail::depth_delta(tokens[i].kind) != 0) {
+      auto depth = res.depth[i];
+      if (starts.size() <= depth + 1) {
+        starts.resize(depth + 2);
+      }
+      ++starts[depth + 1];
+      ++delimiters;
+    }
+  }
+  for (std::size_t d = 1; d < starts.size(); ++d) {
+    starts[d] += starts[d - 1];
+  }
+
+  std::vector<std::uint32_t> by_depth(delimiters);
+  {
+    auto next = starts;
+    for (std::size_t i = 0; i != tokens.size(); ++i) {
+      if (detail::depth_delta(tokens[i].kind) != 0) {
+        by_depth[next[res.depth[i]]++] = static_cast<std::uint32_t>(i);
+      }
+    }
+  }
+
+  // within a depth an opening delimiter is followed by its match, an
+  // unterminated one is the last delimiter of its depth. Closing delimiters
+  // without an opening delimiter before them are stray, which only happens
+  // at depth 0.
+  auto eof = static_cast<std::uint32_t>(tokens.size() - 1);
+  auto is_open = [&](std::uint32_t idx) {
+    return detail::depth_delta(tokens[idx].kind) > 0;
+  };
+  for (std::size_t d = 0; d + 1 < starts.size(); ++d) {
+    auto end = starts[d + 1];
+    for (auto k = starts[d]; k != end;) {
+      auto idx = by_depth[k++];
+      if (!is_open(idx)) {
+        res.stray.push_back(idx);
+        continue;
+      }
+      if (k == end || is_open(by_depth[k])) {
+        res.match[idx] = eof;
+        res.unclosed.push_back(idx);
+        continue;
+      }
+
+      auto close = by_depth[k++];
+      res.match[idx] = close;
+      res.match[close] = idx;
+      if (detail::closer_for(tokens[idx].kind) != tokens[close].kind) {
+        res.mismatched.push_back(close);
+      }
+    }
+  }
+  // reported in token order
+  std::ranges::sort(res.mismatched);
+
+  return res;
+}
+} // namespace green
+} // namespace ely
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ely/green/list.hpp"
+
+namespace ely {
+namespace green {
+enum class edit_kind : std::uint8_t {
+  insert,
+  remove,
+  replace,
+};
+
+// a change to the children of a list of the old tree, old_parent, which
+// corresponds to new_parent in the new tree
+struct tree_edit {
+  edit_kind kind;
+  const list* old_parent;
+  const list* new_parent;
+  // position of the child in both lists. Inserts are placed before old_index,
+  // removed children would have been at new_index.
+  std::size_t old_index;
+  std::size_t new_index;
+  const list::value_type* old_node; // removed or replaced, null for inserts
+  const list::value_type* new_node; // inserted or replacement, null for
+                                    // removals
+};
+
+struct diff_options {
+  // replaced lists are diffed in turn, otherwise only the direct children of
+  // the roots are compared
+  bool recurse = true;
+};
+
+namespace detail {
+enum class diff_op : std::uint8_t { keep, remove, insert };
+
+// Myers' shortest edit script between two sequences of length n and m, in
+// O((n + m) * d) time for d edits and O(n + m) space. The furthest reaching
+// paths from both ends meet on a middle snake of a shortest script, the parts
+// before and after it are solved recursively.
+// eq(i, j) compares the i-th element of the first with the j-th element of the
+// second sequence.
+template <typename Eq> class shortest_edit_solver {
+  using index = std::ptrdiff_t;
+
+  // a run of matches from (x0, y0) to (x1, y1), relative to a subproblem
+  struct snake {
+    index x0, y0, x1, y1;
+  };
+
+  Eq* eq_;
+  index off_;
+  std::vector<index> fwd_; // furthest x on every diagonal k = x - y
+  std::vector<index> bwd_; // the same, from the ends of both sequences
+
+public:
+  std::vector<diff_op> res;
+
+  constexpr shortest_edit_solver(std::size_t n, std::size_t m, Eq& eq)
+      : eq_(std::addressof(eq)),
+        off_(static_cast<index>((n + m + 1) / 2 + 1)),
+        fwd_(static_cast<std::size_t>(2 * off_ + 1)),
+        bwd_(static_cast<std::size_t>(2 * off_ + 1)) {
+    res.reserve(n + m);
+  }
+
+  // the edits turning [a0, a1) into [b0, b1)
+  constexpr void solve(index a0, index a1, index b0, index b1) {
+    auto& eq = *eq_;
+    while (a0 != a1 && b0 != b1 && eq(a0, b0)) {
+      res.push_back(diff_op::keep);
+      ++a0;
+      ++b0;
+    }
+    index suffix = 0;
+    while (a0 != a1 && b0 != b1 && eq(a1 - 1, b1 - 1)) {
+      --a1;
+      --b1;
+      ++suffix;
+    }
+
+    if (a0 == a1) {
+      res.insert(res.end(), static_cast<std::size_t>(b1 - b0),
+                 diff_op::insert);
+    } else if (b0 == b1) {
+      res.insert(res.end(), static_cast<std::size_t>(a1 - a0),
+                 diff_op::remove);
+    } else {
+      auto s = middle_snake(a0, a1 - a0, b0, b1 - b0);
+      solve(a0, a0 + s.x0, b0, b0 + s.y0);
+      res.insert(res.end(), static_cast<std::size_t>(s.x1 - s.x0),
+                 diff_op::keep);
+      solve(a0 + s.x1, a1, b0 + s.y1, b1);
+    }
+
+    res.insert(res.end(), static_cast<std::size_t>(suffix), diff_op::keep);
+  }
+
+private:
+  // both sequences are non empty and differ in their first and last element
+  constexpr snake middle_snake(index a0, index n, index b0, index m) {
+    auto& eq = *eq_;
+    // the backward diagonal c = delta - k runs along the forward diagonal k
+    auto delta = n - m;
+    bool odd = (delta & 1) != 0;
+    auto fwd = [&](index k) -> index& { return fwd_[off_ + k]; };
+    auto bwd = [&](index c) -> index& { return bwd_[off_ + c]; };
+    fwd(1) = 0;
+    bwd(1) = 0;
+
+    for (index d = 0;; ++d) {
+      for (index k = -d; k <= d; k += 2) {
+        auto x = (k == -d || (k != d && fwd(k - 1) < fwd(k + 1)))
+                     ? fwd(k + 1)
+                     : fwd(k - 1) + 1;
+        auto y = x - k;
+        auto x0 = x, y0 = y;
+        while (x < n && y < m && eq(a0 + x, b0 + y)) {
+          ++x;
+          ++y;
+        }
+        fwd(k) = x;
+
+        auto c = delta - k;
+        if (odd && c >= -(d - 1) && c <= d - 1 && x + bwd(c) >= n) {
+          return snake{x0, y0, x, y};
+        }
+      }
+
+      for (index c = -d; c <= d; c += 2) {
+        auto x = (c == -d || (c != d && bwd(c - 1) < bwd(c + 1)))
+                     ? bwd(c + 1)
+                     : bwd(c - 1) + 1;
+        auto y = x - c;
+        auto x0 = x, y0 = y;
+        while (x < n && y < m && eq(a0 + n - x - 1, b0 + m - y - 1)) {
+          ++x;
+          ++y;
+        }
+        bwd(c) = x;
+
+        auto k = delta - c;
+        if (!odd && k >= -d && k <= d && fwd(k) + x >= n) {
+          return snake{n - x, m - y, n - x0, m - y0};
+        }
+      }
+    }
+  }
+};
+
+template <typename Eq>
+constexpr std::vector<diff_op> shortest_edit(std::size_t n, std::size_t m,
+                                             Eq eq) {
+  auto solver = shortest_edit_solver<Eq>(n, m, eq);
+  solver.solve(0, static_cast<std::ptrdiff_t>(n), 0,
+               static_cast<std::ptrdiff_t>(m));
+  return std::move(solver.res);
+}
+} // namespace detail
+
+// edit script turning the children of before into those of after. Children
+// are matched by structural hash and equality, the unmatched ones between two
+// matches are paired up as replacements and the rest removed or inserted.
+// Replaced lists are diffed recursively, unless disabled by options.
+// Common prefixes and suffixes are skipped before diffing, so typical edits
+// take close to linear time in the number of children.
+// Edits of the same list are ordered by position, edits of nested lists follow
+// those of their parent.
+constexpr std::vector<tree_edit> diff(const list& before, const list& after,
+                                      diff_options options = {}) {
+  std::vector<tree_edit> res;
+  std::vector<std::pair<const list*, const list*>> todo{{&before, &after}};
+
+  while (!todo.empty()) {
+    auto [l, r] = todo.back();
+    todo.pop_back();
+
+    auto equal = [&](std::size_t i, std::size_t j) {
+      return structurally_equal((*l)[i], (*r)[j]);
+    };
+
+    std::size_t first = 0;
+    while (first != l->size() && first != r->size() && equal(first, first)) {
+      ++first;
+    }
+    std::size_t l_last = l->size();
+    std::size_t r_last = r->size();
+    while (l_last != first && r_last != first &&
+           equal(l_last - 1, r_last - 1)) {
+      --l_last;
+      --r_last;
+    }
+
+    auto ops = detail::shortest_edit(
+        l_last - first, r_last - first, [&](auto i, auto j) {
+          return equal(first + static_cast<std::size_t>(i),
+                       first + static_cast<std::size_t>(j));
+        });
+
+    // unmatched children since the last match
+    std::size_t li = first, ri = first;
+    std::size_t removed = 0, inserted = 0;
+    auto flush = [&] {
+      auto l_start = li - removed;
+      auto r_start = ri - inserted;
+      auto paired = std::min(removed, inserted);
+
+      for (std::size_t p = 0; p != paired; ++p) {
+        const auto& lc = (*l)[l_start + p];
+        const auto& rc = (*r)[r_start + p];
+        if (options.recurse && lc.as_list() && rc.as_list()) {
+          todo.emplace_back(lc.as_list(), rc.as_list());
+          continue;
+        }
+        res.push_back(tree_edit{edit_kind::replace, l, r, l_start + p,
+                                r_start + p, &lc, &rc});
+      }
+      for (auto p = paired; p != removed; ++p) {
+        res.push_back(tree_edit{edit_kind::remove, l, r, l_start + p, ri,
+                                &(*l)[l_start + p], nullptr});
+      }
+      for (auto p = paired; p != inserted; ++p) {
+        res.push_back(tree_edit{edit_kind::insert, l, r, li, r_start + p,
+                                nullptr, &(*r)[r_start + p]});
+      }
+      removed = 0;
+      inserted = 0;
+    };
+
+    for (auto op : ops) {
+      switch (op) {
+      case detail::diff_op::keep:
+        flush();
+        ++li;
+        ++ri;
+        break;
+      case detail::diff_op::remove:
+        ++li;
+        ++removed;
+        break;
+      case detail::diff_op::insert:
+        ++ri;
+        ++inserted;
+        break;
+      }
+    }
+    flush();
+  }
+
+  return res;
+}
+} // namespace green
+} // namespace ely
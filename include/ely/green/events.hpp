@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ely/green/brackets.hpp"
+#include "ely/green/flat.hpp"
+#include "ely/green/list.hpp"
+#include "ely/green/parser.hpp"
+#include "ely/stx/token.hpp"
+#include "ely/stx/tokens.hpp"
+
+namespace ely {
+namespace green {
+// the events of parsing tokens, without building any nodes. Parses the same
+// grammar as parser, see detail::parse_element.
+// tokens must be terminated by eof, as returned by stx::tokenize
+constexpr std::vector<event> parse_events(std::span<const stx::token> tokens) {
+  assert(!tokens.empty() && tokens.back().kind == stx::token_kind::eof);
+
+  struct collect {
+    std::vector<event> res;
+
+    constexpr void start_node(const event& ev) { res.push_back(ev); }
+    constexpr void token(const event& ev) { res.push_back(ev); }
+    constexpr void finish_node(const event& ev) { res.push_back(ev); }
+  };
+
+  auto sink = collect{};
+  sink.res.reserve(tokens.size());
+  detail::parse_root(tokens, 0, sink);
+  return std::move(sink.res);
+}
+
+// feeds events to every sink in a single pass, green_sink builds the same
+// tree as parser::parse_file().
+template <typename... Sinks>
+constexpr void replay(std::span<const event> events, Sinks&... sinks) {
+  for (const auto& ev : events) {
+    switch (ev.kind) {
+    case event_kind::start_node:
+      (sinks.start_node(ev), ...);
+      break;
+    case event_kind::token:
+      (sinks.token(ev), ...);
+      break;
+    case event_kind::finish_node:
+      (sinks.finish_node(ev), ...);
+      break;
+    }
+  }
+}
+
+// writes the same flat tree as serialize(parser::parse_file()), without
+// building green nodes or interning identifiers
+template <typename Arena> class flat_sink {
+  struct frame {
+    std::size_t first_node;
+    std::size_t size;
+    std::uint32_t offset;
+    std::uint32_t open_width;
+  };
+
+  std::string_view src_;
+  std::span<const stx::token> tokens_;
+  Arena* arena_; // string literals containing escapes
+  detail::flat_writer writer_;
+  std::vector<frame> stack_;
+  std::vector<std::byte> res_;
+
+public:
+  flat_sink(std::string_view src, std::span<const stx::token> tokens,
+            Arena& arena)
+      : src_(src), tokens_(tokens), arena_(std::addressof(arena)) {}
+
+  void start_node(const event& ev) {
+    auto f = frame{writer_.node_count(), 0, ev.offset, 0};
+    if (ev.token != event::no_token) {
+      const auto& tok = tokens_[ev.token];
+      auto width = tok.end() - ev.offset;
+      if (detail::is_prefix(tok.kind)) {
+        writer_.write_identifier(width, detail::prefix_name(tok.kind));
+        f.size = 1;
+      } else {
+        f.open_width = width;
+      }
+    }
+    stack_.push_back(f);
+  }
+
+  void token(const event& ev) {
+    const auto& tok = tokens_[ev.token];
+    auto str = src_.substr(tok.offset, tok.width);
+    auto width = tok.end() - ev.offset;
+
+    switch (tok.kind) {
+    case stx::token_kind::integer_lit:
+      writer_.write_int(width, detail::parse_number<std::int64_t>(str));
+      break;
+    case stx::token_kind::decimal_lit:
+      writer_.write_float(width, detail::parse_number<float>(str));
+      break;
+    case stx::token_kind::string_lit:
+      writer_.write_string(
+          width, detail::unescape(*arena_, detail::string_contents(str)));
+      break;
+    default:
+      writer_.write_identifier(width, str);
+    }
+    ++stack_.back().size;
+  }
+
+  void finish_node(const event& ev) {
+    auto top = stack_.back();
+    stack_.pop_back();
+    writer_.write_list(ev.offset - top.offset, top.open_width, top.size,
+                       writer_.node_count() - top.first_node + 1);
+
+    if (stack_.empty()) {
+      res_ = writer_.finish();
+    } else {
+      ++stack_.back().size;
+    }
+  }
+
+  // only valid after the root has been finished
+  std::span<const std::byte> bytes() const { return res_; }
+};
+
+// prints the structure in the same layout as formatting a green tree, atoms
+// are printed as they appear in the source
+class print_sink {
+  std::string_view src_;
+  std::span<const stx::token> tokens_;
+  std::string out_;
+  bool first_ = true; // nothing printed in the current list yet
+
+public:
+  print_sink(std::string_view src, std::span<const stx::token> tokens)
+      : src_(src), tokens_(tokens) {}
+
+  void start_node(const event& ev) {
+    separate();
+    out_ += '(';
+    first_ = true;
+    if (ev.token != event::no_token &&
+        detail::is_prefix(tokens_[ev.token].kind)) {
+      out_ += detail::prefix_name(tokens_[ev.token].kind);
+      first_ = false;
+    }
+  }
+
+  void token(const event& ev) {
+    separate();
+    const auto& tok = tokens_[ev.token];
+    out_ += src_.substr(tok.offset, tok.width);
+    first_ = false;
+  }
+
+  void finish_node(const event&) {
+    out_ += ')';
+    first_ = false;
+  }
+
+  const std::string& str() const { return out_; }
+
+private:
+  void separate() {
+    if (!first_) {
+      out_ += ' ';
+    }
+  }
+};
+
+// structure statistics, without looking at the source
+struct count_sink {
+  std::size_t lists = 0; // including the root
+  std::size_t tokens = 0;
+  std::size_t max_depth = 0;
+  std::size_t depth = 0;
+
+  constexpr void start_node(const event&) {
+    ++lists;
+    max_depth = std::max(max_depth, ++depth);
+  }
+
+  constexpr void token(const event&) { ++tokens; }
+
+  constexpr void finish_node(const event&) { --depth; }
+};
+} // namespace green
+} // namespace ely
@@ -0,0 +1,522 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ely/green/list.hpp"
+#include "ely/green/token.hpp"
+#include "ely/util/optional.hpp"
+#include "ely/util/visit.hpp"
+
+#include <fmt/base.h>
+
+namespace ely {
+namespace green {
+// flat trees store the nodes of a green tree in post-order in a single buffer,
+// so they can be written to disk or handed to another process and read in
+// place, e.g. from a memory mapping.
+//
+// layout, every section starts 8 byte aligned, native byte order:
+//   header
+//   widths          u32[node_count]
+//   extents         u32[node_count]  nodes in the subtree, including itself
+//   data            u32[node_count]  string index or value index
+//   values          u64[value_count] literals, list child count and open width
+//   kinds           u8[node_count]
+//   string offsets  u32[string_count + 1]
+//   strings         char[string_bytes]
+enum class flat_kind : std::uint8_t {
+  int_literal,
+  float_literal,
+  string_literal,
+  identifier,
+  list,
+};
+
+struct flat_header {
+  static constexpr std::uint32_t magic_value = 0x47594c45; // "ELYG"
+  static constexpr std::uint32_t current_version = 1;
+
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t node_count;
+  std::uint32_t value_count;
+  std::uint32_t string_count;
+  std::uint32_t string_bytes;
+};
+
+namespace detail {
+constexpr std::size_t flat_align(std::size_t n) {
+  return (n + 7) & ~std::size_t{7};
+}
+
+// byte offset of every section
+struct flat_layout {
+  std::size_t widths;
+  std::size_t extents;
+  std::size_t data;
+  std::size_t values;
+  std::size_t kinds;
+  std::size_t string_offsets;
+  std::size_t strings;
+  std::size_t size;
+
+  explicit constexpr flat_layout(const flat_header& h) {
+    std::size_t n = h.node_count;
+    widths = flat_align(sizeof(flat_header));
+    extents = widths + flat_align(n * sizeof(std::uint32_t));
+    data = extents + flat_align(n * sizeof(std::uint32_t));
+    values = data + flat_align(n * sizeof(std::uint32_t));
+    kinds = values + h.value_count * sizeof(std::uint64_t);
+    string_offsets = kinds + flat_align(n);
+    strings = string_offsets +
+              flat_align((h.string_count + std::size_t{1}) *
+                         sizeof(std::uint32_t));
+    size = strings + h.string_bytes;
+  }
+};
+
+constexpr std::uint64_t pack_list(std::size_t size, std::size_t open_width) {
+  return (static_cast<std::uint64_t>(size) << 32) |
+         static_cast<std::uint32_t>(open_width);
+}
+
+class flat_writer {
+  std::vector<std::uint32_t> widths_;
+  std::vector<std::uint32_t> extents_;
+  std::vector<std::uint32_t> data_;
+  std::vector<std::uint64_t> values_;
+  std::vector<std::uint8_t> kinds_;
+  std::vector<std::uint32_t> string_offsets_{0};
+  std::string strings_;
+  // keys refer to the strings of the tree being written
+  std::unordered_map<std::string_view, std::uint32_t> string_ids_;
+
+public:
+  // identifiers are written by their names in interner
+  template <typename Interner>
+  void write(const list::value_type& node, const Interner& interner) {
+    ely::visit([&](const auto& x) { write(x, interner); }, node);
+  }
+
+  template <typename Interner>
+  void write(const token& tok, const Interner& interner) {
+    ely::visit(
+        [&]<typename T>(const T& x) {
+          if constexpr (std::same_as<T, identifier>) {
+            write_identifier(x.width(), interner.lookup(x.sym()));
+          } else {
+            write(x);
+          }
+        },
+        tok);
+  }
+
+  void write(const int_literal& lit) { write_int(lit.width(), lit.value()); }
+
+  void write(const float_literal& lit) {
+    write_float(lit.width(), lit.value());
+  }
+
+  void write(const string_literal& lit) {
+    write_string(lit.width(), lit.value());
+  }
+
+  template <typename Interner>
+  void write(const list& l, const Interner& interner) {
+    auto start = node_count();
+    for (const auto& child : l) {
+      write(child, interner);
+    }
+    write_list(l.width(), l.open_width(), l.size(), node_count() - start + 1);
+  }
+
+  // nodes written so far
+  std::size_t node_count() const { return kinds_.size(); }
+
+  void write_int(std::size_t width, std::int64_t value) {
+    push(flat_kind::int_literal, width, 1,
+         push_value(std::bit_cast<std::uint64_t>(value)));
+  }
+
+  void write_float(std::size_t width, float value) {
+    push(flat_kind::float_literal, width, 1,
+         push_value(std::bit_cast<std::uint32_t>(value)));
+  }
+
+  // str must stay valid until finish()
+  void write_string(std::size_t width, std::string_view str) {
+    push(flat_kind::string_literal, width, 1, push_string(str));
+  }
+
+  void write_identifier(std::size_t width, std::string_view name) {
+    push(flat_kind::identifier, width, 1, push_string(name));
+  }
+
+  // after all its children, extent includes the list itself
+  void write_list(std::size_t width, std::size_t open_width, std::size_t size,
+                  std::size_t extent) {
+    push(flat_kind::list, width, extent,
+         push_value(pack_list(size, open_width)));
+  }
+
+  std::vector<std::byte> finish() const {
+    auto header = flat_header{
+        .magic = flat_header::magic_value,
+        .version = flat_header::current_version,
+        .node_count = static_cast<std::uint32_t>(kinds_.size()),
+        .value_count = static_cast<std::uint32_t>(values_.size()),
+        .string_count = static_cast<std::uint32_t>(string_offsets_.size() - 1),
+        .string_bytes = static_cast<std::uint32_t>(strings_.size()),
+    };
+    auto layout = flat_layout(header);
+
+    auto res = std::vector<std::byte>(layout.size);
+    auto copy = [&](std::size_t offset, const auto& range) {
+      if (!range.empty()) {
+        std::memcpy(res.data() + offset, range.data(),
+                    range.size() * sizeof(range[0]));
+      }
+    };
+
+    std::memcpy(res.data(), &header, sizeof(header));
+    copy(layout.widths, widths_);
+    copy(layout.extents, extents_);
+    copy(layout.data, data_);
+    copy(layout.values, values_);
+    copy(layout.kinds, kinds_);
+    copy(layout.string_offsets, string_offsets_);
+    copy(layout.strings, strings_);
+    return res;
+  }
+
+private:
+  void push(flat_kind kind, std::size_t width, std::size_t extent,
+            std::uint32_t data) {
+    widths_.push_back(static_cast<std::uint32_t>(width));
+    extents_.push_back(static_cast<std::uint32_t>(extent));
+    data_.push_back(data);
+    kinds_.push_back(static_cast<std::uint8_t>(kind));
+  }
+
+  std::uint32_t push_value(std::uint64_t value) {
+    values_.push_back(value);
+    return static_cast<std::uint32_t>(values_.size() - 1);
+  }
+
+  // identifiers and equal string literals share their entry
+  std::uint32_t push_string(std::string_view str) {
+    auto [it, inserted] = string_ids_.try_emplace(
+        str, static_cast<std::uint32_t>(string_offsets_.size() - 1));
+    if (inserted) {
+      strings_.append(str);
+      string_offsets_.push_back(static_cast<std::uint32_t>(strings_.size()));
+    }
+    return it->second;
+  }
+};
+} // namespace detail
+
+// serialize root and all its descendants, identifiers are stored by their
+// names in interner
+template <typename Interner>
+std::vector<std::byte> serialize(const list& root, const Interner& interner) {
+  auto writer = detail::flat_writer{};
+  writer.write(root, interner);
+  return writer.finish();
+}
+
+class flat_tree;
+
+// a node of a flat tree, only valid as long as the underlying buffer
+class flat_node {
+  const flat_tree* tree_;
+  std::uint32_t index_;
+
+public:
+  class const_reverse_iterator;
+
+  flat_node() = default;
+  constexpr flat_node(const flat_tree& tree, std::uint32_t index)
+      : tree_(std::addressof(tree)), index_(index) {}
+
+  constexpr std::uint32_t index() const { return index_; }
+  inline flat_kind kind() const;
+  inline std::size_t width() const;
+  // number of nodes in this subtree, including this node
+  inline std::size_t extent() const;
+
+  bool is_list() const { return kind() == flat_kind::list; }
+
+  // lists only
+  inline std::size_t size() const;
+  inline std::size_t open_width() const;
+
+  // literals and identifiers of the matching kind only
+  inline std::int64_t int_value() const;
+  inline float float_value() const;
+  // string literal value or identifier name
+  inline std::string_view text() const;
+
+  // children are reached back to front, the last child directly precedes its
+  // list and every other child precedes the subtree of its next sibling.
+  inline const_reverse_iterator rbegin() const;
+  inline const_reverse_iterator rend() const;
+
+  friend constexpr bool operator==(const flat_node& lhs, const flat_node& rhs) {
+    return lhs.tree_ == rhs.tree_ && lhs.index_ == rhs.index_;
+  }
+};
+
+// a view of a serialized tree, reads directly from the buffer without copying
+// anything. The buffer must be 8 byte aligned, which both memory mappings and
+// the result of serialize are.
+class flat_tree {
+  friend class flat_node;
+
+  flat_header header_;
+  const std::uint32_t* widths_;
+  const std::uint32_t* extents_;
+  const std::uint32_t* data_;
+  const std::uint64_t* values_;
+  const std::uint8_t* kinds_;
+  const std::uint32_t* string_offsets_;
+  const char* strings_;
+
+  flat_tree() = default;
+
+public:
+  // checks the header, the buffer size and every extent, index and offset
+  // against the sizes of the sections, so nothing read through the tree can
+  // leave the buffer. Returns nullopt for anything truncated or corrupt.
+  static ely::optional<flat_tree> open(std::span<const std::byte> bytes) {
+    if (bytes.size() < sizeof(flat_header) ||
+        reinterpret_cast<std::uintptr_t>(bytes.data()) % 8 != 0) {
+      return ely::nullopt;
+    }
+
+    auto res = flat_tree{};
+    std::memcpy(&res.header_, bytes.data(), sizeof(flat_header));
+    const auto& h = res.header_;
+    if (h.magic != flat_header::magic_value ||
+        h.version != flat_header::current_version || h.node_count == 0) {
+      return ely::nullopt;
+    }
+
+    auto layout = detail::flat_layout(h);
+    if (layout.size > bytes.size()) {
+      return ely::nullopt;
+    }
+
+    const std::byte* base = bytes.data();
+    res.widths_ = reinterpret_cast<const std::uint32_t*>(base + layout.widths);
+    res.extents_ =
+        reinterpret_cast<const std::uint32_t*>(base + layout.extents);
+    res.data_ = reinterpret_cast<const std::uint32_t*>(base + layout.data);
+    res.values_ = reinterpret_cast<const std::uint64_t*>(base + layout.values);
+    res.kinds_ = reinterpret_cast<const std::uint8_t*>(base + layout.kinds);
+    res.string_offsets_ =
+        reinterpret_cast<const std::uint32_t*>(base + layout.string_offsets);
+    res.strings_ = reinterpret_cast<const char*>(base + layout.strings);
+    if (!res.valid()) {
+      return ely::nullopt;
+    }
+    return res;
+  }
+
+  std::size_t size() const { return header_.node_count; }
+  std::size_t string_count() const { return header_.string_count; }
+
+  // nodes in storage order, which is post-order
+  flat_node operator[](std::size_t i) const {
+    assert(i < size());
+    return flat_node(*this, static_cast<std::uint32_t>(i));
+  }
+
+  // the root is always the last node
+  flat_node root() const { return (*this)[size() - 1]; }
+
+  std::string_view string(std::size_t i) const {
+    assert(i < string_count());
+    return {strings_ + string_offsets_[i],
+            string_offsets_[i + 1] - string_offsets_[i]};
+  }
+
+private:
+  // every node refers to its own section entries, every list is exactly
+  // covered by its children and the root covers every node
+  bool valid() const {
+    const auto& h = header_;
+    if (string_offsets_[0] != 0) {
+      return false;
+    }
+    for (std::size_t i = 0; i != h.string_count; ++i) {
+      if (string_offsets_[i + 1] < string_offsets_[i]) {
+        return false;
+      }
+    }
+    if (string_offsets_[h.string_count] > h.string_bytes) {
+      return false;
+    }
+
+    for (std::uint32_t i = 0; i != h.node_count; ++i) {
+      auto extent = extents_[i];
+      auto data = data_[i];
+      switch (static_cast<flat_kind>(kinds_[i])) {
+      case flat_kind::int_literal:
+      case flat_kind::float_literal:
+        if (extent != 1 || data >= h.value_count) {
+          return false;
+        }
+        break;
+      case flat_kind::string_literal:
+      case flat_kind::identifier:
+        if (extent != 1 || data >= h.string_count) {
+          return false;
+        }
+        break;
+      case flat_kind::list: {
+        if (extent == 0 || extent > i + 1 || data >= h.value_count) {
+          return false;
+        }
+        // walk the children the way const_reverse_iterator does
+        auto first = i + 1 - extent;
+        std::size_t children = 0;
+        for (auto end = i; end != first; ++children) {
+          auto child = extents_[end - 1];
+          if (child == 0 || child > end - first) {
+            return false;
+          }
+          end -= child;
+        }
+        if (children != (values_[data] >> 32)) {
+          return false;
+        }
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+
+    return extents_[h.node_count - 1] == h.node_count;
+  }
+};
+
+class flat_node::const_reverse_iterator {
+  const flat_tree* tree_;
+  std::uint32_t index_; // one past the node's position
+
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = flat_node;
+  using difference_type = std::ptrdiff_t;
+  using reference = flat_node;
+  using pointer = void;
+
+  const_reverse_iterator() = default;
+  constexpr const_reverse_iterator(const flat_tree& tree, std::uint32_t index)
+      : tree_(std::addressof(tree)), index_(index) {}
+
+  flat_node operator*() const { return flat_node(*tree_, index_ - 1); }
+
+  const_reverse_iterator& operator++() {
+    index_ -= tree_->extents_[index_ - 1];
+    return *this;
+  }
+
+  const_reverse_iterator operator++(int) {
+    auto res = *this;
+    ++*this;
+    return res;
+  }
+
+  friend bool operator==(const const_reverse_iterator&,
+                         const const_reverse_iterator&) = default;
+};
+
+inline flat_kind flat_node::kind() const {
+  return static_cast<flat_kind>(tree_->kinds_[index_]);
+}
+
+inline std::size_t flat_node::width() const { return tree_->widths_[index_]; }
+
+inline std::size_t flat_node::extent() const {
+  return tree_->extents_[index_];
+}
+
+inline std::size_t flat_node::size() const {
+  assert(is_list());
+  return tree_->values_[tree_->data_[index_]] >> 32;
+}
+
+inline std::size_t flat_node::open_width() const {
+  assert(is_list());
+  return static_cast<std::uint32_t>(tree_->values_[tree_->data_[index_]]);
+}
+
+inline std::int64_t flat_node::int_value() const {
+  assert(kind() == flat_kind::int_literal);
+  return std::bit_cast<std::int64_t>(tree_->values_[tree_->data_[index_]]);
+}
+
+inline float flat_node::float_value() const {
+  assert(kind() == flat_kind::float_literal);
+  return std::bit_cast<float>(
+      static_cast<std::uint32_t>(tree_->values_[tree_->data_[index_]]));
+}
+
+inline std::string_view flat_node::text() const {
+  assert(kind() == flat_kind::string_literal ||
+         kind() == flat_kind::identifier);
+  return tree_->string(tree_->data_[index_]);
+}
+
+inline flat_node::const_reverse_iterator flat_node::rbegin() const {
+  return const_reverse_iterator(*tree_, index_);
+}
+
+inline flat_node::const_reverse_iterator flat_node::rend() const {
+  return const_reverse_iterator(*tree_,
+                                index_ + 1 - static_cast<std::uint32_t>(
+                                                 extent()));
+}
+} // namespace green
+} // namespace ely
+
+template <> struct fmt::formatter<ely::green::flat_node> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  auto format(const ely::green::flat_node& node, FmtCtx& ctx) const {
+    using enum ely::green::flat_kind;
+
+    switch (node.kind()) {
+    case int_literal:
+      return fmt::format_to(ctx.out(), "{}", node.int_value());
+    case float_literal:
+      return fmt::format_to(ctx.out(), "{}", node.float_value());
+    case string_literal:
+      return fmt::format_to(ctx.out(), "\"{}\"", node.text());
+    case identifier:
+      return fmt::format_to(ctx.out(), "{}", node.text());
+    case list:
+      break;
+    }
+
+    auto children = std::vector<ely::green::flat_node>(node.rbegin(),
+                                                       node.rend());
+    std::ranges::reverse(children);
+    return fmt::format_to(ctx.out(), "({})", fmt::join(children, " "));
+  }
+};
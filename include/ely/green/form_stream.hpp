@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ely/arena/basic.hpp"
+#include "ely/green/list.hpp"
+#include "ely/green/parallel.hpp"
+#include "ely/green/parser.hpp"
+#include "ely/stx/token.hpp"
+#include "ely/util/optional.hpp"
+
+namespace ely {
+namespace green {
+// parses a file one top level form at a time while only keeping a window of
+// the source in memory. Every form is allocated in an arena region which is
+// released by the following call to next(), so memory stays proportional to
+// the largest form rather than the whole file.
+// A form, including the string literals referring to the window, is only
+// valid until the next call to next(). Identifiers are owned by the interner
+// and outlive the form. Origins are relative to base, the origin of the start
+// of the file.
+template <typename Interner, typename Arena> class form_stream {
+private:
+  std::FILE* in_;
+  Interner* interner_;
+  Arena* arena_;
+  arena::marker mark_;
+  std::size_t chunk_size_;
+  ely::origin base_;
+  std::size_t dropped_ = 0; // bytes of the file preceding window_
+
+  std::string window_; // unparsed source, '\0' terminated once lexed
+  std::vector<stx::token> tokens_;
+  std::vector<std::size_t> forms_; // start token of every form in window_
+  std::size_t next_form_ = 0;
+  bool eof_ = false;
+
+public:
+  form_stream(std::FILE* in, Interner& interner, Arena& arena,
+              std::size_t chunk_size = 64 * 1024, ely::origin base = {})
+      : in_(in), interner_(std::addressof(interner)),
+        arena_(std::addressof(arena)), mark_(arena.mark()),
+        chunk_size_(chunk_size), base_(base) {}
+
+  form_stream(const form_stream&) = delete;
+  form_stream& operator=(const form_stream&) = delete;
+
+  ~form_stream() { arena_->release(mark_); }
+
+  // the next top level form, nullopt once the file is exhausted
+  ely::optional<list::value_type> next() {
+    // the consumer is done with the previous form
+    arena_->release(mark_);
+
+    // the last form of the window might continue after it, it's only parsed
+    // once the file has been read entirely
+    while (next_form_ + 1 >= forms_.size() && !eof_) {
+      refill();
+    }
+
+    if (next_form_ == forms_.size()) {
+      return ely::nullopt;
+    }
+
+    auto p = parser(std::string_view(window_), tokens_, *interner_, *arena_,
+                    forms_[next_form_++], base_ + dropped_);
+    return p.next();
+  }
+
+private:
+  // drops the parsed forms from the window and appends the next chunk
+  void refill() {
+    if (!window_.empty()) {
+      window_.pop_back(); // '\0'
+    }
+
+    // without any form the window only holds atmosphere, which is kept as a
+    // comment might continue in the next chunk
+    if (next_form_ < forms_.size()) {
+      auto offset = tokens_[forms_[next_form_]].offset;
+      window_.erase(0, offset);
+      dropped_ += offset;
+    }
+
+    auto size = window_.size();
+    // at least double the window so a form larger than a chunk only causes a
+    // logarithmic number of refills
+    auto grow = std::max(chunk_size_, size);
+    window_.resize(size + grow);
+    auto read = std::fread(window_.data() + size, 1, grow, in_);
+    window_.resize(size + read);
+    eof_ = read < grow;
+    window_.push_back('\0');
+
+    tokens_ = stx::tokenize(window_);
+    forms_ = top_level_forms(tokens_);
+    next_form_ = 0;
+  }
+};
+} // namespace green
+} // namespace ely
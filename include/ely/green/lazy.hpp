@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "ely/green/brackets.hpp"
+#include "ely/green/list.hpp"
+#include "ely/green/parser.hpp"
+#include "ely/origin.hpp"
+#include "ely/stx/token.hpp"
+
+namespace ely {
+namespace green {
+// parses lists only once their children are accessed. Every list is created
+// from its token range, using the bracket match table to skip over its
+// contents, so walking only the top level of a file costs about as much as
+// lexing it.
+// Trees refer to the parser, which must outlive them, as well as the source,
+// the interner and the arena. Origins are assigned as by parser.
+template <typename Interner, typename Arena> class lazy_parser {
+private:
+  struct body : list::lazy_body {
+    const lazy_parser* parser;
+    std::uint32_t first; // token following the opening delimiter
+    std::uint32_t last;  // closing delimiter or eof
+  };
+
+  std::string_view src_;
+  std::span<const stx::token> tokens_;
+  bracket_table brackets_;
+  Interner* interner_;
+  Arena* arena_;
+  ely::origin base_;
+
+public:
+  // tokens must be terminated by eof, as returned by stx::tokenize
+  lazy_parser(std::string_view src, std::span<const stx::token> tokens,
+              Interner& interner, Arena& arena, ely::origin base = {})
+      : src_(src), tokens_(tokens), brackets_(match_brackets(tokens)),
+        interner_(std::addressof(interner)), arena_(std::addressof(arena)),
+        base_(base) {
+    assert(!tokens.empty() && tokens.back().kind == stx::token_kind::eof);
+  }
+
+  lazy_parser(const lazy_parser&) = delete;
+  lazy_parser& operator=(const lazy_parser&) = delete;
+
+  // the top level is parsed right away, every list is lazy
+  list parse_file() const {
+    auto builder = list_builder(*arena_);
+    parse_children(0, eof_index(), builder);
+    return builder.finish(base_);
+  }
+
+private:
+  std::uint32_t eof_index() const {
+    return static_cast<std::uint32_t>(tokens_.size() - 1);
+  }
+
+  std::size_t skip_atmosphere(std::uint32_t& pos) const {
+    std::size_t width = 0;
+    while (tokens_[pos].is_atmosphere()) {
+      width += tokens_[pos].width;
+      ++pos;
+    }
+    return width;
+  }
+
+  static void parse_body(const list::lazy_body& self,
+                         const list::value_type*& children,
+                         std::size_t& size) {
+    const auto& b = static_cast<const body&>(self);
+    auto builder = list_builder(*b.parser->arena_);
+    b.parser->parse_children(b.first, b.last, builder);
+    auto l = builder.finish();
+    children = l.begin();
+    size = l.size();
+  }
+
+  // elements up to last, which is consumed as the closing delimiter
+  void parse_children(std::uint32_t pos, std::uint32_t last,
+                      list_builder<Arena>& builder) const {
+    while (true) {
+      auto lead = skip_atmosphere(pos);
+      if (pos == last) {
+        builder.close(lead + tokens_[last].width);
+        return;
+      }
+      builder.emplace_back(parse_element(pos, lead, last));
+    }
+  }
+
+  list::value_type parse_element(std::uint32_t& pos, std::size_t lead,
+                                 std::uint32_t last) const {
+    const auto& tok = tokens_[pos];
+
+    if (detail::depth_delta(tok.kind) > 0) {
+      auto close = brackets_.match[pos];
+      auto* b = arena_->template allocate<body>();
+      std::construct_at(b, body{{&parse_body}, this, pos + 1, close});
+
+      auto start = tok.offset - lead;
+      auto res = list(*b, tokens_[close].end() - start, lead + tok.width,
+                      base_ + tok.offset);
+      // eof isn't consumed by unterminated lists
+      pos = close == eof_index() ? close : close + 1;
+      return list::value_type::create(*arena_, res);
+    }
+
+    if (detail::is_prefix(tok.kind)) {
+      auto builder = list_builder(*arena_);
+      auto origin = base_ + tok.offset;
+      builder.emplace_back(
+          detail::make_identifier(*interner_, detail::prefix_name(tok.kind),
+                                  lead + tok.width, origin));
+      ++pos;
+
+      auto start = pos;
+      auto atmosphere = skip_atmosphere(pos);
+      if (pos == last || detail::depth_delta(tokens_[pos].kind) < 0) {
+        // leave the atmosphere and the closing delimiter to the enclosing
+        // list, as in parser
+        pos = start;
+      } else {
+        builder.emplace_back(parse_element(pos, atmosphere, last));
+      }
+      return list::value_type::create(*arena_, builder.finish(origin));
+    }
+
+    ++pos;
+    return list::value_type::create(
+        *arena_, detail::make_token(*interner_, *arena_, tok,
+                                    src_.substr(tok.offset, tok.width),
+                                    lead + tok.width, base_ + tok.offset));
+  }
+};
+} // namespace green
+} // namespace ely
@@ -1,18 +1,22 @@
 #pragma once
 
 #include "ely/green/token.hpp"
-#include "ely/util/variant.hpp"
+#include "ely/origin.hpp"
+#include "ely/util/variant_size.hpp"
 #include "ely/util/visit.hpp"
 
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <utility>
+#include <vector>
+
 #include <fmt/base.h>
 
 namespace ely {
 namespace green {
-class list;
-
-namespace detail {
-using token_or_list_variant = ely::variant<ely::green::list, ely::green::token>;
-}
 class list {
 private:
   class token_or_list;
@@ -21,58 +25,531 @@ private:
 
 public:
   using value_type = token_or_list;
+  using const_iterator = const value_type*;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  // produces the children of a list which hasn't been parsed yet, usually
+  // embedded in a larger object carrying the parser state
+  struct lazy_body {
+    void (*parse)(const lazy_body& self, const value_type*& children,
+                  std::size_t& size);
+  };
 
 private:
-  void* token_span_;  // implementation defined token span
-  std::size_t width_; // cached text width
-  std::vector<value_type> children_;
+  // set until the children of a lazy list are parsed, which happens on the
+  // first access to them. Forcing a list is not synchronized, and copies of
+  // a list which hasn't been forced yet parse their children separately.
+  static constexpr std::uint32_t no_hash = 0;
+
+  mutable const lazy_body* lazy_ = nullptr;
+  std::size_t width_ = 0;        // cached text width
+  std::uint32_t open_width_ = 0; // width preceding the first child
+  // opening delimiter, prefix or start of the file for the root
+  ely::origin origin_{};
+  // children are immutable and owned by an arena, copies of a list share them
+  // which allows reusing untouched subtrees when rebuilding a tree after an
+  // edit.
+  mutable const value_type* children_ = nullptr;
+  mutable std::uint32_t size_ = 0;
+  // of the children, no_hash until first asked for. Hashing visits every
+  // child, so it is left out of construction where it would force lazy
+  // children.
+  mutable std::uint32_t hash_ = no_hash;
 
 public:
   list() = default;
-  constexpr list(std::vector<value_type>&& children, std::size_t width = {},
-                 void* token_span = nullptr);
+  constexpr list(const value_type* children, std::size_t size,
+                 std::size_t width = {}, std::size_t open_width = {},
+                 ely::origin origin = {})
+      : lazy_(nullptr), width_(width),
+        open_width_(static_cast<std::uint32_t>(open_width)), origin_(origin),
+        children_(children), size_(static_cast<std::uint32_t>(size)) {}
+
+  // widths are known up front, the children are parsed by lazy once needed
+  constexpr list(const lazy_body& lazy, std::size_t width,
+                 std::size_t open_width, ely::origin origin = {})
+      : lazy_(std::addressof(lazy)), width_(width),
+        open_width_(static_cast<std::uint32_t>(open_width)), origin_(origin),
+        children_(nullptr), size_(0) {}
+
+  constexpr bool is_lazy() const { return lazy_ != nullptr; }
 
+  // width includes leading atmosphere, delimiters and trailing atmosphere
+  // before the closing delimiter
   constexpr auto width() const { return width_; }
-  constexpr auto size() const;
+  // offset of the first child relative to the start of this list
+  constexpr std::size_t open_width() const { return open_width_; }
+  constexpr ely::origin origin() const { return origin_; }
+  constexpr std::size_t size() const {
+    force();
+    return size_;
+  }
+
+  // structural hash, forces a lazy list and its lazy descendants
+  constexpr std::uint32_t hash() const {
+    if (hash_ == no_hash) {
+      force();
+      hash_ = children_hash(children_, size_);
+    }
+    return hash_;
+  }
+
+  constexpr const_iterator begin() const;
+  constexpr const_iterator end() const;
+
+  constexpr const_reverse_iterator rbegin() const;
+  constexpr const_reverse_iterator rend() const;
 
-  constexpr auto begin() const { return children_.begin(); }
-  constexpr auto end() const { return children_.end(); }
+  constexpr const value_type& operator[](std::size_t i) const;
+
+  // both lists share the same children, not just equal children
+  constexpr bool is_same(const list& other) const {
+    return lazy_ == other.lazy_ && children_ == other.children_ &&
+           size_ == other.size_;
+  }
+
+private:
+  static constexpr std::uint32_t children_hash(const value_type* children,
+                                               std::size_t size);
 
-  constexpr auto rbegin() const { return children_.rbegin(); }
-  constexpr auto rend() const { return children_.rend(); }
+  constexpr void force() const {
+    if (lazy_) [[unlikely]] {
+      std::size_t size = 0;
+      lazy_->parse(*lazy_, children_, size);
+      lazy_ = nullptr;
+      size_ = static_cast<std::uint32_t>(size);
+    }
+  }
 };
 
-class list::token_or_list : public ely::variant<green::token, green::list> {
+// a child is a single tagged pointer to an arena allocated token or list. It
+// provides the same unchecked access as ely::variant<token, list>, so it can
+// be used with ely::visit.
+class list::token_or_list {
   friend class ::fmt::formatter<list::token_or_list>;
 
+private:
+  // token and list are at least 8 byte aligned, the lowest bit is free
+  static constexpr std::uintptr_t list_tag = 1;
+
+  std::uintptr_t bits_ = 0;
+
 public:
-  using ely::variant<green::token, green::list>::variant;
+  token_or_list() = default;
+
+  explicit constexpr token_or_list(const green::token* t)
+      : bits_(reinterpret_cast<std::uintptr_t>(t)) {}
+
+  explicit constexpr token_or_list(const green::list* l)
+      : bits_(reinterpret_cast<std::uintptr_t>(l) | list_tag) {}
+
+  // copy x into the arena
+  template <typename Arena, typename T>
+    requires(std::same_as<std::remove_cvref_t<T>, green::token> ||
+             std::same_as<std::remove_cvref_t<T>, green::list>)
+  static constexpr token_or_list create(Arena& arena, T&& x) {
+    using type = std::remove_cvref_t<T>;
+    type* p = arena.template allocate<type>();
+    std::construct_at(p, static_cast<T&&>(x));
+    return token_or_list(static_cast<const type*>(p));
+  }
+
+  static constexpr std::size_t size() noexcept { return 2; }
+
+  constexpr std::size_t index() const noexcept { return bits_ & list_tag; }
+
+  constexpr const green::token&
+  get_unchecked(std::in_place_index_t<0>) const noexcept {
+    assert(index() == 0);
+    return *reinterpret_cast<const green::token*>(bits_);
+  }
+
+  constexpr const green::list&
+  get_unchecked(std::in_place_index_t<1>) const noexcept {
+    assert(index() == 1);
+    return *reinterpret_cast<const green::list*>(bits_ & ~list_tag);
+  }
+
+  constexpr const green::token&
+  get_unchecked(std::in_place_type_t<green::token>) const noexcept {
+    return get_unchecked(std::in_place_index<0>);
+  }
+
+  constexpr const green::list&
+  get_unchecked(std::in_place_type_t<green::list>) const noexcept {
+    return get_unchecked(std::in_place_index<1>);
+  }
+
+  constexpr std::size_t width() const {
+    return ely::visit([](const auto& x) -> std::size_t { return x.width(); },
+                      *this);
+  }
+
+  constexpr ely::origin origin() const {
+    return ely::visit([](const auto& x) { return x.origin(); }, *this);
+  }
+
+  constexpr std::uint32_t hash() const {
+    return ely::visit([](const auto& x) { return x.hash(); }, *this);
+  }
+
+  constexpr const green::token* as_token() const {
+    if (index() != 0) {
+      return nullptr;
+    }
+    return std::addressof(get_unchecked(std::in_place_index<0>));
+  }
+
+  constexpr const green::list* as_list() const {
+    if (index() != 1) {
+      return nullptr;
+    }
+    return std::addressof(get_unchecked(std::in_place_index<1>));
+  }
+
+  // same node, not just an equal one
+  friend bool operator==(const token_or_list&, const token_or_list&) = default;
 };
 
-constexpr list::list(std::vector<value_type>&& children, std::size_t width,
-                     void* token_span)
-    : token_span_(token_span), width_(width), children_(std::move(children)) {}
+static_assert(sizeof(list::value_type) == sizeof(void*));
+static_assert(sizeof(list) == 5 * sizeof(void*));
+
+constexpr list::const_iterator list::begin() const {
+  force();
+  return children_;
+}
+
+constexpr list::const_iterator list::end() const {
+  force();
+  return children_ + size_;
+}
+
+constexpr list::const_reverse_iterator list::rbegin() const {
+  return const_reverse_iterator(end());
+}
+
+constexpr list::const_reverse_iterator list::rend() const {
+  return const_reverse_iterator(begin());
+}
+
+constexpr const list::value_type& list::operator[](std::size_t i) const {
+  force();
+  assert(i < size());
+  return children_[i];
+}
+
+constexpr std::uint32_t list::children_hash(const value_type* children,
+                                            std::size_t size) {
+  auto res = static_cast<std::uint64_t>(detail::hash_tag::list);
+  for (std::size_t i = 0; i != size; ++i) {
+    res = detail::mix_hash(res, children[i].hash());
+  }
+  auto h = detail::fold_hash(res);
+  return h == no_hash ? no_hash + 1 : h;
+}
+
+// same shape and structurally equal tokens, ignoring widths and origins.
+// Differing hashes are rejected right away, otherwise both trees are compared
+// while skipping subtrees they share.
+constexpr bool structurally_equal(const list& lhs, const list& rhs) {
+  if (lhs.hash() != rhs.hash()) {
+    return false;
+  }
+
+  std::vector<std::pair<const list*, const list*>> todo{{&lhs, &rhs}};
+  while (!todo.empty()) {
+    auto [l, r] = todo.back();
+    todo.pop_back();
+    if (l->is_same(*r)) {
+      continue;
+    }
+    if (l->hash() != r->hash() || l->size() != r->size()) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i != l->size(); ++i) {
+      const auto& lc = (*l)[i];
+      const auto& rc = (*r)[i];
+      if (lc == rc) {
+        continue;
+      }
+      if (lc.index() != rc.index() || lc.hash() != rc.hash()) {
+        return false;
+      }
+      if (const list* ll = lc.as_list()) {
+        todo.emplace_back(ll, rc.as_list());
+      } else if (!structurally_equal(*lc.as_token(), *rc.as_token())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+constexpr bool structurally_equal(const list::value_type& lhs,
+                                  const list::value_type& rhs) {
+  if (lhs.index() != rhs.index()) {
+    return false;
+  }
+  if (const list* l = lhs.as_list()) {
+    return structurally_equal(*l, *rhs.as_list());
+  }
+  return structurally_equal(*lhs.as_token(), *rhs.as_token());
+}
+
+// hash and equality of tables keyed by structure, such as dedup caches
+struct structural_hash {
+  template <typename Node>
+  constexpr std::size_t operator()(const Node& node) const {
+    return node.hash();
+  }
+};
 
-constexpr auto list::size() const { return children_.size(); }
+struct structural_equal {
+  template <typename Node>
+  constexpr bool operator()(const Node& lhs, const Node& rhs) const {
+    return structurally_equal(lhs, rhs);
+  }
+};
 
-class list_builder {
+template <typename Arena> class list_builder {
 public:
   using value_type = typename list::value_type;
 
 private:
+  Arena* arena_;
   std::vector<value_type> children_;
+  std::size_t width_{};
+  std::size_t open_width_{};
 
 public:
   list_builder() = default;
+  explicit constexpr list_builder(Arena& arena)
+      : arena_(std::addressof(arena)) {}
 
   constexpr void reserve(std::size_t cap) { return children_.reserve(cap); }
+
+  // a node which has already been allocated, possibly shared with other lists
+  constexpr value_type& emplace_back(value_type child) {
+    auto& res = children_.emplace_back(child);
+    width_ += res.width();
+    return res;
+  }
+
+  constexpr value_type& emplace_back(const list& l) {
+    return emplace_back(value_type::create(*arena_, l));
+  }
+
   template <typename... Args>
+    requires(std::constructible_from<token, Args...>)
   constexpr value_type& emplace_back(Args&&... args) {
-    return children_.emplace_back(static_cast<Args&&>(args)...);
+    return emplace_back(
+        value_type::create(*arena_, token(static_cast<Args&&>(args)...)));
+  }
+
+  // leading atmosphere and opening delimiter, must precede all children
+  constexpr void open(std::size_t width) {
+    assert(children_.empty());
+    width_ += width;
+    open_width_ = width_;
+  }
+
+  // trailing atmosphere and closing delimiter
+  constexpr void close(std::size_t width) { width_ += width; }
+
+  constexpr list finish(ely::origin origin = {}) {
+    value_type* children = arena_->template allocate<value_type>(
+        children_.size());
+    std::uninitialized_copy(children_.begin(), children_.end(), children);
+    return list(children, children_.size(), width_, open_width_, origin);
+  }
+};
+
+enum class cursor_step : std::uint8_t {
+  enter, // a list, before its children
+  token,
+  leave, // a list, after its children
+};
+
+// walks a tree without recursion, the only state is a stack of the lists
+// entered so far. Every list is visited twice, on enter in pre-order and on
+// leave in post-order, tokens once in between.
+// Offsets are tracked through the cached widths, so skipping a subtree
+// doesn't touch any of its nodes. A cursor is also a single pass input range
+// over its own states:
+//
+//   for (auto& c : cursor(root)) {
+//     if (c.step() == cursor_step::enter && is_irrelevant(*c.as_list())) {
+//       c.skip();
+//     }
+//   }
+class cursor {
+private:
+  struct frame {
+    const list* parent;
+    std::size_t index;  // next child
+    std::size_t offset; // start of the next child
+    std::size_t start;  // start of parent
+  };
+
+  std::vector<frame> stack_;
+  cursor_step step_ = cursor_step::enter;
+  const list* list_ = nullptr;
+  const token* token_ = nullptr;
+  std::size_t offset_ = 0;
+  bool skip_ = false; // leave the list just entered on the next step
+
+public:
+  class iterator {
+    cursor* c_ = nullptr;
+
+  public:
+    using value_type = cursor;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit constexpr iterator(cursor& c) : c_(std::addressof(c)) {}
+
+    constexpr cursor& operator*() const { return *c_; }
+
+    constexpr iterator& operator++() {
+      c_->next();
+      return *this;
+    }
+    constexpr void operator++(int) { ++*this; }
+
+    friend constexpr bool operator==(const iterator& it,
+                                     std::default_sentinel_t) {
+      return it.c_->done();
+    }
+  };
+
+  // done right away
+  cursor() = default;
+
+  // starts by entering root, offsets are relative to the start of root
+  explicit constexpr cursor(const list& root) : list_(std::addressof(root)) {}
+
+  // start over at root, keeping the memory of the stack
+  constexpr void reset(const list& root) {
+    stack_.clear();
+    step_ = cursor_step::enter;
+    list_ = std::addressof(root);
+    token_ = nullptr;
+    offset_ = 0;
+    skip_ = false;
+  }
+
+  // after leaving the root
+  constexpr bool done() const { return list_ == nullptr && token_ == nullptr; }
+
+  constexpr cursor_step step() const { return step_; }
+
+  // set on enter and leave
+  constexpr const list* as_list() const { return list_; }
+  // set on token
+  constexpr const token* as_token() const { return token_; }
+
+  // start of the current node, including its leading atmosphere
+  constexpr std::size_t offset() const { return offset_; }
+  constexpr std::size_t width() const {
+    return list_ ? list_->width() : token_->width();
+  }
+
+  // number of lists enclosing the current node
+  constexpr std::size_t depth() const { return stack_.size(); }
+
+  constexpr void next() {
+    assert(!done());
+    if (step_ == cursor_step::enter) {
+      if (skip_) {
+        skip_ = false;
+        step_ = cursor_step::leave;
+        return;
+      }
+      stack_.push_back(
+          frame{list_, 0, offset_ + list_->open_width(), offset_});
+    }
+    advance();
   }
 
-  constexpr list finish() { return list(std::move(children_)); }
+  // the next step leaves the list just entered, without visiting any of its
+  // children
+  constexpr void skip() {
+    assert(step_ == cursor_step::enter);
+    skip_ = true;
+  }
+
+  constexpr iterator begin() { return iterator(*this); }
+  constexpr std::default_sentinel_t end() const { return {}; }
+
+private:
+  constexpr void advance() {
+    list_ = nullptr;
+    token_ = nullptr;
+    if (stack_.empty()) {
+      return;
+    }
+
+    auto& top = stack_.back();
+    if (top.index == top.parent->size()) {
+      step_ = cursor_step::leave;
+      list_ = top.parent;
+      offset_ = top.start;
+      stack_.pop_back();
+      return;
+    }
+
+    const auto& child = (*top.parent)[top.index++];
+    offset_ = top.offset;
+    top.offset += child.width();
+    if ((list_ = child.as_list())) {
+      step_ = cursor_step::enter;
+    } else {
+      step_ = cursor_step::token;
+      token_ = child.as_token();
+    }
+  }
 };
+
+static_assert(std::ranges::input_range<cursor>);
+} // namespace green
+
+template <>
+struct variant_size<green::list::value_type>
+    : std::integral_constant<std::size_t, 2> {};
+} // namespace ely
+
+namespace ely {
+namespace green {
+namespace detail {
+// iterative, so deeply nested lists can be formatted as well. Tokens are
+// written by write_token(out, token).
+template <typename Out, typename F>
+constexpr Out format_list(Out out, const list& l, F write_token) {
+  bool first = true; // nothing written in the current list yet
+  for (const auto& c : cursor(l)) {
+    if (c.step() != cursor_step::leave && !first) {
+      *out++ = ' ';
+    }
+    switch (c.step()) {
+    case cursor_step::enter:
+      *out++ = '(';
+      first = true;
+      break;
+    case cursor_step::token:
+      out = write_token(out, *c.as_token());
+      first = false;
+      break;
+    case cursor_step::leave:
+      *out++ = ')';
+      first = false;
+      break;
+    }
+  }
+  return out;
+}
+} // namespace detail
 } // namespace green
 } // namespace ely
 
@@ -96,6 +573,41 @@ template <> struct fmt::formatter<ely::green::list> {
 
   template <typename FmtCtx>
   constexpr auto format(const ely::green::list& l, FmtCtx& ctx) const {
-    return fmt::format_to(ctx.out(), "({})", fmt::join(l, " "));
+    return ely::green::detail::format_list(
+        ctx.out(), l, [](auto out, const ely::green::token& t) {
+          return fmt::format_to(out, "{}", t);
+        });
+  }
+};
+
+template <typename Interner>
+struct fmt::formatter<ely::green::named<ely::green::list, Interner>> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto format(const ely::green::named<ely::green::list, Interner>& l,
+                        FmtCtx& ctx) const {
+    return ely::green::detail::format_list(
+        ctx.out(), l.node, [&](auto out, const ely::green::token& t) {
+          return fmt::format_to(out, "{}", ely::green::named(t, l.interner));
+        });
+  }
+};
+
+template <typename Interner>
+struct fmt::formatter<
+    ely::green::named<ely::green::list::value_type, Interner>> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto
+  format(const ely::green::named<ely::green::list::value_type, Interner>& tl,
+         FmtCtx& ctx) const {
+    return ely::visit(
+        [&]<typename T>(const T& t_or_l) {
+          auto fmt = ::fmt::formatter<ely::green::named<T, Interner>>{};
+          return fmt.format(ely::green::named(t_or_l, tl.interner), ctx);
+        },
+        tl.node);
   }
-};
\ No newline at end of file
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ely/green/brackets.hpp"
+#include "ely/green/list.hpp"
+#include "ely/green/parser.hpp"
+#include "ely/stx/token.hpp"
+#include "ely/stx/tokens.hpp"
+
+namespace ely {
+namespace green {
+namespace detail {
+// gives a worker its own view of a shared interner, only names the worker
+// hasn't seen before take the lock.
+template <typename Interner> class shared_interner_ref {
+public:
+  using symbol_type = typename Interner::symbol_type;
+  using string_view_type = typename Interner::string_view_type;
+
+private:
+  Interner* interner_;
+  std::mutex* mutex_;
+  std::unordered_map<string_view_type, symbol_type> symbols_;
+  std::vector<string_view_type> names_; // indexed by symbol id
+
+public:
+  shared_interner_ref(Interner& interner, std::mutex& mutex)
+      : interner_(std::addressof(interner)), mutex_(std::addressof(mutex)) {}
+
+  symbol_type intern(string_view_type str) {
+    if (auto it = symbols_.find(str); it != symbols_.end()) {
+      return it->second;
+    }
+
+    auto lock = std::lock_guard(*mutex_);
+    auto sym = interner_->intern(str);
+    // the interned copy outlives str
+    auto name = interner_->lookup(sym);
+
+    symbols_.emplace(name, sym);
+    if (names_.size() <= sym.id) {
+      names_.resize(sym.id + 1);
+    }
+    names_[sym.id] = name;
+    return sym;
+  }
+
+  // only valid for symbols returned by intern
+  string_view_type lookup(symbol_type sym) const { return names_[sym.id]; }
+};
+} // namespace detail
+
+// token index at which each top level element starts, including its leading
+// atmosphere. Matches what parser::next() would consume, any closing delimiter
+// closes the innermost list and stray closing delimiters form their own
+// element, even directly after a prefix. Lists are skipped using the bracket
+// table.
+constexpr std::vector<std::size_t>
+top_level_forms(std::span<const stx::token> tokens,
+                const bracket_table& brackets) {
+  std::vector<std::size_t> res;
+
+  std::size_t start = 0; // first token after the previous top level element
+  bool prefixed = false; // the next element belongs to a preceding prefix
+  // token following the last prefix
+  std::size_t prefix_end = 0;
+
+  for (std::size_t i = 0; i != tokens.size(); ++i) {
+    auto kind = tokens[i].kind;
+    if (ely_token_is_atmosphere(kind)) {
+      continue;
+    }
+    if (kind == stx::token_kind::eof) {
+      break;
+    }
+
+    if (prefixed && detail::depth_delta(kind) < 0) {
+      // the prefix stays empty and its trailing atmosphere starts the stray
+      // closing delimiter
+      prefixed = false;
+      start = prefix_end;
+    }
+    if (!prefixed) {
+      res.push_back(start);
+    }
+
+    if (detail::depth_delta(kind) > 0) {
+      i = brackets.match[i];
+      if (tokens[i].kind == stx::token_kind::eof) {
+        // unterminated, the list takes the rest of the file
+        break;
+      }
+    }
+
+    prefixed = detail::is_prefix(kind);
+    if (prefixed) {
+      prefix_end = i + 1;
+    } else {
+      start = i + 1;
+    }
+  }
+
+  return res;
+}
+
+constexpr std::vector<std::size_t>
+top_level_forms(std::span<const stx::token> tokens) {
+  return top_level_forms(tokens, match_brackets(tokens));
+}
+
+// parse top level elements concurrently and join them in source order into
+// the same root list parser::parse_file() would produce.
+// Top level elements are grouped into chunks of similar token counts, which
+// workers take in turn, so many small forms don't turn into many tiny tasks.
+// One worker runs per arena, each worker only allocates from its own arena.
+template <typename Interner, typename Arena>
+list parse_file_parallel(std::string_view src,
+                         std::span<const stx::token> tokens,
+                         Interner& interner, std::span<Arena> arenas,
+                         ely::origin base = {}) {
+  assert(!arenas.empty());
+  auto forms = top_level_forms(tokens);
+  auto num_threads = arenas.size();
+
+  // few forms aren't worth the threads
+  if (num_threads == 1 || forms.size() < 2 * num_threads) {
+    return parser(src, tokens, interner, arenas.front(), 0, base)
+        .parse_file();
+  }
+
+  // chunk boundaries as indices into forms, aim for a few chunks per thread to
+  // balance uneven forms
+  auto target_chunks = 4 * num_threads;
+  auto chunk_tokens = tokens.size() / target_chunks + 1;
+  std::vector<std::size_t> chunks{0};
+  for (std::size_t i = 1; i != forms.size(); ++i) {
+    if (forms[i] - forms[chunks.back()] >= chunk_tokens) {
+      chunks.push_back(i);
+    }
+  }
+  chunks.push_back(forms.size());
+
+  auto num_chunks = chunks.size() - 1;
+  std::vector<std::vector<list::value_type>> results(num_chunks);
+  std::size_t end_pos = 0; // token following the last form
+  std::atomic<std::size_t> next_chunk{0};
+  std::mutex interner_mutex;
+
+  auto work = [&](Arena& arena) {
+    auto local_interner =
+        detail::shared_interner_ref<Interner>(interner, interner_mutex);
+
+    while (true) {
+      auto c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (c >= num_chunks) {
+        return;
+      }
+
+      auto first = chunks[c];
+      auto last = chunks[c + 1];
+      auto& out = results[c];
+      out.reserve(last - first);
+
+      // every worker has its own parser, the tokens are only read
+      auto p =
+          parser(src, tokens, local_interner, arena, forms[first], base);
+      for (auto i = first; i != last; ++i) {
+        auto el = p.next();
+        assert(el);
+        out.push_back(*el);
+      }
+
+      if (c + 1 == num_chunks) {
+        end_pos = p.position();
+      }
+    }
+  };
+
+  {
+    std::vector<std::jthread> workers;
+    workers.reserve(num_threads - 1);
+    for (std::size_t i = 1; i != num_threads; ++i) {
+      workers.emplace_back(work, std::ref(arenas[i]));
+    }
+    work(arenas.front());
+  }
+
+  auto builder = list_builder(arenas.front());
+  builder.reserve(forms.size());
+  for (auto& chunk : results) {
+    for (auto& el : chunk) {
+      builder.emplace_back(el);
+    }
+  }
+
+  // trailing atmosphere after the last form
+  std::size_t trailing = 0;
+  for (auto i = end_pos; tokens[i].kind != stx::token_kind::eof; ++i) {
+    trailing += tokens[i].width;
+  }
+  builder.close(trailing);
+
+  return builder.finish(base);
+}
+} // namespace green
+} // namespace ely
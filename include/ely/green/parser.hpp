@@ -0,0 +1,505 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "ely/green/brackets.hpp"
+#include "ely/green/list.hpp"
+#include "ely/green/token.hpp"
+#include "ely/origin.hpp"
+#include "ely/stx/token.hpp"
+#include "ely/stx/tokens.hpp"
+#include "ely/util/optional.hpp"
+
+namespace ely {
+namespace green {
+// replacement of old_width characters at offset by new_width characters
+struct text_edit {
+  std::size_t offset;
+  std::size_t old_width;
+  std::size_t new_width;
+
+  constexpr std::ptrdiff_t delta() const {
+    return static_cast<std::ptrdiff_t>(new_width) -
+           static_cast<std::ptrdiff_t>(old_width);
+  }
+};
+
+namespace detail {
+// the identifier a prefix expands to, 'x => (quote x)
+constexpr std::string_view prefix_name(stx::token_kind tk) {
+  switch (tk) {
+  case stx::token_kind::quote:
+    return "quote";
+  case stx::token_kind::quasiquote:
+    return "quasiquote";
+  case stx::token_kind::unquote:
+    return "unquote";
+  case stx::token_kind::unquote_splicing:
+    return "unquote-splicing";
+  case stx::token_kind::syntax:
+    return "syntax";
+  case stx::token_kind::quasisyntax:
+    return "quasisyntax";
+  case stx::token_kind::unsyntax:
+    return "unsyntax";
+  case stx::token_kind::unsyntax_splicing:
+    return "unsyntax-splicing";
+  default:
+    return {};
+  }
+}
+
+template <typename Interner>
+constexpr identifier make_identifier(Interner& interner, std::string_view str,
+                                     std::size_t width,
+                                     ely::origin origin = {}) {
+  auto sym = interner.intern(str);
+  return identifier(sym, interner.lookup(sym), width, origin);
+}
+
+// replaces escape sequences, only allocates when there are any
+template <typename Arena>
+constexpr std::string_view unescape(Arena& arena, std::string_view str) {
+  if (str.find('\\') == std::string_view::npos) {
+    return str;
+  }
+
+  char* out = arena.template allocate<char>(str.size());
+  std::size_t size = 0;
+  for (auto it = str.begin(); it != str.end(); ++it) {
+    if (*it != '\\' || std::next(it) == str.end()) {
+      out[size++] = *it;
+      continue;
+    }
+
+    switch (*++it) {
+    case 'n':
+      out[size++] = '\n';
+      break;
+    case 't':
+      out[size++] = '\t';
+      break;
+    case 'r':
+      out[size++] = '\r';
+      break;
+    case '0':
+      out[size++] = '\0';
+      break;
+    default:
+      // \\, \" and unknown escapes keep the escaped character
+      out[size++] = *it;
+    }
+  }
+
+  return {out, size};
+}
+
+template <typename T> constexpr T parse_number(std::string_view str) {
+  T val{};
+  std::from_chars(str.data(), str.data() + str.size(), val);
+  return val;
+}
+
+// text of a string literal without the quotes
+constexpr std::string_view string_contents(std::string_view str) {
+  return str.substr(1, str.size() - 2);
+}
+
+// the green token for a non delimiter, non prefix token with source text str
+template <typename Interner, typename Arena>
+constexpr token make_token(Interner& interner, Arena& arena,
+                           const stx::token& tok, std::string_view str,
+                           std::size_t width, ely::origin origin = {}) {
+  switch (tok.kind) {
+  case stx::token_kind::integer_lit:
+    return token(std::in_place_type<int_literal>,
+                 parse_number<std::int64_t>(str), width, origin);
+  case stx::token_kind::decimal_lit:
+    return token(std::in_place_type<float_literal>, parse_number<float>(str),
+                 width, origin);
+  case stx::token_kind::string_lit:
+    return token(std::in_place_type<string_literal>,
+                 unescape(arena, string_contents(str)), width, origin);
+  default:
+    // identifiers, keywords, booleans and anything unrecognized
+    return token(make_identifier(interner, str, width, origin));
+  }
+}
+} // namespace detail
+
+enum class event_kind : std::uint8_t {
+  start_node,
+  token,
+  finish_node,
+};
+
+// the structure of a parse as a flat sequence, every start_node is matched by
+// a finish_node and the events in between are its children. The whole file is
+// wrapped in a root node.
+struct event {
+  static constexpr std::uint32_t no_token =
+      std::numeric_limits<std::uint32_t>::max();
+
+  event_kind kind;
+  // start_node: opening delimiter or prefix, no_token for the root
+  // token: the token itself
+  // finish_node: closing delimiter, no_token if the node wasn't closed by one
+  std::uint32_t token;
+  // start_node and token: start of the element, including its leading
+  //   atmosphere
+  // finish_node: end of the node
+  std::uint32_t offset;
+
+  friend bool operator==(const event&, const event&) = default;
+};
+
+namespace detail {
+// first token at or after pos which isn't atmosphere
+constexpr std::size_t skip_atmosphere(std::span<const stx::token> tokens,
+                                      std::size_t pos) {
+  while (tokens[pos].is_atmosphere()) {
+    ++pos;
+  }
+  return pos;
+}
+
+enum class open_node : bool { list, prefix };
+
+// the grammar, shared by parser and parse_events. Reports the element
+// following the atmosphere at pos to sink and returns the position after it,
+// the atmosphere must not be followed by eof.
+// A sink provides start_node(const event&), token(const event&) and
+// finish_node(const event&).
+// The lists and prefixes enclosing the current token are kept in open instead
+// of recursing, so nesting is only limited by memory. open must be empty, it
+// is only passed in to reuse its storage.
+template <typename Sink>
+constexpr std::size_t parse_element(std::span<const stx::token> tokens,
+                                    std::size_t pos, Sink& sink,
+                                    std::vector<open_node>& open) {
+  assert(open.empty());
+
+  while (true) {
+    auto start = tokens[pos].offset;
+    auto next = skip_atmosphere(tokens, pos);
+    const auto& tok = tokens[next];
+    auto idx = static_cast<std::uint32_t>(next);
+    bool closes =
+        tok.kind == stx::token_kind::eof || depth_delta(tok.kind) < 0;
+
+    if (!open.empty() && closes) {
+      auto node = open.back();
+      open.pop_back();
+      if (node == open_node::prefix) {
+        // a closing delimiter isn't an element, the prefix stays empty and
+        // leaves the atmosphere and the delimiter to the enclosing list
+        sink.finish_node(event{event_kind::finish_node, event::no_token,
+                               tokens[pos - 1].end()});
+      } else if (tok.kind == stx::token_kind::eof) {
+        // unterminated lists take the trailing atmosphere
+        sink.finish_node(
+            event{event_kind::finish_node, event::no_token, tok.offset});
+        pos = next;
+      } else {
+        sink.finish_node(event{event_kind::finish_node, idx, tok.end()});
+        pos = next + 1;
+      }
+    } else {
+      assert(tok.kind != stx::token_kind::eof);
+      pos = next + 1;
+
+      if (is_prefix(tok.kind)) {
+        // 'x => (quote x)
+        sink.start_node(event{event_kind::start_node, idx, start});
+        open.push_back(open_node::prefix);
+        continue;
+      }
+      if (depth_delta(tok.kind) > 0) {
+        sink.start_node(event{event_kind::start_node, idx, start});
+        open.push_back(open_node::list);
+        continue;
+      }
+      // stray closing delimiters become tokens
+      sink.token(event{event_kind::token, idx, start});
+    }
+
+    // a prefix only spans the element following it
+    while (!open.empty() && open.back() == open_node::prefix) {
+      open.pop_back();
+      sink.finish_node(event{event_kind::finish_node, event::no_token,
+                             tokens[pos - 1].end()});
+    }
+    if (open.empty()) {
+      return pos;
+    }
+  }
+}
+
+// the elements from pos to eof, wrapped in a root node
+template <typename Sink>
+constexpr void parse_root(std::span<const stx::token> tokens, std::size_t pos,
+                          Sink& sink) {
+  std::vector<open_node> open;
+  sink.start_node(
+      event{event_kind::start_node, event::no_token, tokens[pos].offset});
+  while (tokens[skip_atmosphere(tokens, pos)].kind !=
+         stx::token_kind::eof) {
+    pos = parse_element(tokens, pos, sink, open);
+  }
+  sink.finish_node(event{event_kind::finish_node, event::no_token,
+                         tokens.back().offset});
+}
+} // namespace detail
+
+// builds green trees from events. Leading atmosphere is attributed to the
+// element following it, so the width of every element includes the
+// atmosphere preceding it.
+// Identifiers are interned and string literals refer to src directly, only
+// literals containing escapes are copied into the arena. The tree can
+// therefore not outlive src, the interner or the arena.
+// Every node records the origin of its first token relative to base, the
+// origin of the start of src. Without a base nodes have no origin.
+template <typename Interner, typename Arena> class green_sink {
+  struct frame {
+    list_builder<Arena> builder;
+    std::uint32_t pos; // end of the last child
+    ely::origin origin;
+    bool root;
+  };
+
+  std::string_view src_;
+  std::span<const stx::token> tokens_;
+  Interner* interner_ = nullptr;
+  Arena* arena_ = nullptr;
+  ely::origin base_;
+  std::vector<frame> stack_;
+  list root_{};
+  list::value_type element_{};
+
+public:
+  green_sink() = default;
+  constexpr green_sink(std::string_view src,
+                       std::span<const stx::token> tokens, Interner& interner,
+                       Arena& arena, ely::origin base = {})
+      : src_(src), tokens_(tokens), interner_(std::addressof(interner)),
+        arena_(std::addressof(arena)), base_(base) {}
+
+  constexpr void start_node(const event& ev) {
+    auto builder = list_builder(*arena_);
+    if (ev.token == event::no_token) {
+      stack_.push_back(frame{std::move(builder), ev.offset, base_, true});
+      return;
+    }
+
+    const auto& tok = tokens_[ev.token];
+    auto width = tok.end() - ev.offset;
+    auto origin = base_ + tok.offset;
+    if (detail::is_prefix(tok.kind)) {
+      // the identifier takes the width and origin of the prefix
+      builder.emplace_back(detail::make_identifier(
+          *interner_, detail::prefix_name(tok.kind), width, origin));
+    } else {
+      builder.open(width);
+    }
+    stack_.push_back(frame{std::move(builder), tok.end(), origin, false});
+  }
+
+  constexpr void token(const event& ev) {
+    const auto& tok = tokens_[ev.token];
+    auto t = detail::make_token(*interner_, *arena_, tok,
+                                src_.substr(tok.offset, tok.width),
+                                tok.end() - ev.offset, base_ + tok.offset);
+    if (stack_.empty()) {
+      element_ = list::value_type::create(*arena_, t);
+      return;
+    }
+    stack_.back().builder.emplace_back(t);
+    stack_.back().pos = tok.end();
+  }
+
+  constexpr void finish_node(const event& ev) {
+    auto top = std::move(stack_.back());
+    stack_.pop_back();
+    top.builder.close(ev.offset - top.pos);
+    auto l = top.builder.finish(top.origin);
+
+    if (top.root) {
+      root_ = l;
+    } else if (stack_.empty()) {
+      element_ = list::value_type::create(*arena_, l);
+    } else {
+      stack_.back().builder.emplace_back(l);
+      stack_.back().pos = ev.offset;
+    }
+  }
+
+  // only valid after the root has been finished
+  constexpr const list& root() const { return root_; }
+
+  // the last element finished outside of any node
+  constexpr list::value_type element() const { return element_; }
+};
+
+// builds green trees from decoded tokens, see green_sink. Nodes are allocated
+// in the arena and are shared between trees produced by reparse.
+template <typename Interner, typename Arena> class parser {
+private:
+  std::span<const stx::token> tokens_;
+  std::size_t pos_ = 0;
+  Arena* arena_ = nullptr;
+  green_sink<Interner, Arena> sink_;
+  std::vector<detail::open_node> open_;
+
+public:
+  parser() = default;
+
+  // tokens must be terminated by eof, as returned by stx::tokenize
+  constexpr parser(std::string_view src, std::span<const stx::token> tokens,
+                   Interner& interner, Arena& arena, std::size_t pos = 0,
+                   ely::origin base = {})
+      : tokens_(tokens), pos_(pos), arena_(std::addressof(arena)),
+        sink_(src, tokens, interner, arena, base) {
+    assert(!tokens.empty() && tokens.back().kind == stx::token_kind::eof);
+  }
+
+  // index of the next token to be consumed
+  constexpr std::size_t position() const { return pos_; }
+
+  // parse the next top level element, returns nullopt once only atmosphere
+  // remains.
+  constexpr ely::optional<list::value_type> next() {
+    if (tokens_[detail::skip_atmosphere(tokens_, pos_)].kind ==
+        stx::token_kind::eof) {
+      // leave the trailing atmosphere for parse_file
+      return ely::nullopt;
+    }
+
+    pos_ = detail::parse_element(tokens_, pos_, sink_, open_);
+    return sink_.element();
+  }
+
+  // parse all remaining elements into a single root list which spans the
+  // entire source.
+  constexpr list parse_file() {
+    detail::parse_root(tokens_, pos_, sink_);
+    pos_ = tokens_.size() - 1;
+    return sink_.root();
+  }
+
+  // rebuild a tree after edit was applied to the source. Only the lists on the
+  // path from the root to the smallest list enclosing the edit are rebuilt,
+  // every other list is shared with old. Rebuilding copies the children of the
+  // lists on that path, making this O(depth * fan-out + edited tokens).
+  // The parser must have been constructed for the edited source, its tokens
+  // can be derived from the old ones with stx::retokenize. Shared nodes
+  // keep their origins in the source they were parsed from, so the edited
+  // source should be registered with the source_map as a new file.
+  constexpr list reparse(const list& old, const text_edit& edit) {
+    struct frame {
+      const list* parent;
+      std::size_t offset;
+      std::size_t index;
+    };
+
+    std::vector<frame> spine;
+    const list* node = std::addressof(old);
+    std::size_t node_offset = 0;
+
+    // find the smallest list which strictly encloses the edit, an edit
+    // touching the end of a list might extend the list so it doesn't count.
+    for (bool descended = true; descended;) {
+      descended = false;
+      auto offset = node_offset + node->open_width();
+
+      for (std::size_t i = 0; i != node->size(); ++i) {
+        const auto& child = (*node)[i];
+        auto width = child.width();
+
+        if (offset > edit.offset) {
+          break;
+        }
+
+        if (edit.offset + edit.old_width < offset + width) {
+          if (const list* l = child.as_list()) {
+            spine.push_back(frame{node, node_offset, i});
+            node = l;
+            node_offset = offset;
+            descended = true;
+          }
+          break;
+        }
+
+        offset += width;
+      }
+    }
+
+    // try the smallest list first, moving to its parent when the edit changed
+    // the boundaries of the list.
+    while (!spine.empty()) {
+      auto expected_width = node->width() + edit.delta();
+      if (auto res = reparse_element(node_offset, expected_width)) {
+        return rebuild_spine(spine, *res, edit.delta());
+      }
+
+      node = spine.back().parent;
+      node_offset = spine.back().offset;
+      spine.pop_back();
+    }
+
+    pos_ = 0;
+    return parse_file();
+  }
+
+private:
+  constexpr ely::optional<list::value_type>
+  reparse_element(std::size_t offset, std::size_t expected_width) {
+    auto it =
+        std::ranges::lower_bound(tokens_, offset, {}, &stx::token::offset);
+    if (it == tokens_.end() || it->offset != offset) {
+      return ely::nullopt;
+    }
+
+    pos_ = static_cast<std::size_t>(it - tokens_.begin());
+    auto res = next();
+    if (!res || (*res).width() != expected_width) {
+      return ely::nullopt;
+    }
+    return res;
+  }
+
+  // the root is returned by value, the lists below it are allocated
+  template <typename Spine>
+  constexpr list rebuild_spine(const Spine& spine, list::value_type child,
+                               std::ptrdiff_t delta) {
+    auto replacement = child;
+    list res;
+
+    for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+      const list& parent = *it->parent;
+      auto* children =
+          arena_->template allocate<list::value_type>(parent.size());
+      std::uninitialized_copy(parent.begin(), parent.end(), children);
+      children[it->index] = replacement;
+
+      res = list(children, parent.size(),
+                 static_cast<std::size_t>(
+                     static_cast<std::ptrdiff_t>(parent.width()) + delta),
+                 parent.open_width(), parent.origin());
+      if (std::next(it) != spine.rend()) {
+        replacement = list::value_type::create(*arena_, res);
+      }
+    }
+
+    return res;
+  }
+};
+} // namespace green
+} // namespace ely
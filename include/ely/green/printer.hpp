@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include <unistd.h>
+
+#include "ely/green/list.hpp"
+#include "ely/green/token.hpp"
+
+namespace ely {
+namespace green {
+enum class print_layout : std::uint8_t {
+  // every list on a single line, the same text as formatting the named list
+  compact,
+  // lists containing other lists put every child after the first on its own
+  // line, indented by their depth
+  indented,
+};
+
+struct print_options {
+  print_layout layout = print_layout::compact;
+  std::size_t indent = 2;
+  // the buffer is written out once it holds this many bytes
+  std::size_t flush_size = 1024 * 1024;
+};
+
+// writes trees to a file descriptor through a single buffer which is reused
+// for every form. The traversal state is kept between forms as well, so
+// printing doesn't allocate once the buffer and the stack are large enough
+// for the largest form.
+// Text is written with write(2), a FILE* writing to the same descriptor has
+// to be flushed before printing and the printer before writing to the FILE*.
+class printer {
+private:
+  int fd_;
+  print_options options_;
+  fmt::memory_buffer buf_;
+  cursor cursor_;
+  std::vector<bool> breaks_; // whether every enclosing list is broken up
+  bool first_ = true;        // nothing written in the current list yet
+  bool ok_ = true;
+
+public:
+  explicit printer(int fd, print_options options = {})
+      : fd_(fd), options_(options) {
+    buf_.reserve(options_.flush_size + options_.flush_size / 8);
+  }
+
+  printer(const printer&) = delete;
+  printer& operator=(const printer&) = delete;
+
+  ~printer() { flush(); }
+
+  // false once a write failed, nothing is written after that
+  bool ok() const { return ok_; }
+
+  // a form followed by a newline, identifiers are written by their names in
+  // interner
+  template <typename Interner>
+  void print(const list& l, const Interner& interner) {
+    first_ = true;
+    cursor_.reset(l);
+    for (auto& c : cursor_) {
+      switch (c.step()) {
+      case cursor_step::enter:
+        separate(c.depth());
+        buf_.push_back('(');
+        first_ = true;
+        if (options_.layout == print_layout::indented) {
+          breaks_.push_back(has_list_child(*c.as_list()));
+        }
+        break;
+      case cursor_step::token:
+        separate(c.depth());
+        write(*c.as_token(), interner);
+        first_ = false;
+        break;
+      case cursor_step::leave:
+        buf_.push_back(')');
+        first_ = false;
+        if (options_.layout == print_layout::indented) {
+          breaks_.pop_back();
+        }
+        break;
+      }
+      maybe_flush();
+    }
+    buf_.push_back('\n');
+    maybe_flush();
+  }
+
+  template <typename Interner>
+  void print(const token& t, const Interner& interner) {
+    write(t, interner);
+    buf_.push_back('\n');
+    maybe_flush();
+  }
+
+  template <typename Interner>
+  void print(const list::value_type& x, const Interner& interner) {
+    ely::visit([&](const auto& node) { print(node, interner); }, x);
+  }
+
+  // write out everything buffered so far
+  bool flush() {
+    const char* data = buf_.data();
+    std::size_t size = buf_.size();
+    while (ok_ && size != 0) {
+      auto written = ::write(fd_, data, size);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ok_ = false;
+        break;
+      }
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+    buf_.clear();
+    return ok_;
+  }
+
+private:
+  static bool has_list_child(const list& l) {
+    return std::ranges::any_of(
+        l, [](const list::value_type& child) { return child.as_list(); });
+  }
+
+  void maybe_flush() {
+    if (buf_.size() >= options_.flush_size) {
+      flush();
+    }
+  }
+
+  void append(std::string_view str) {
+    buf_.append(str.data(), str.data() + str.size());
+  }
+
+  // depth of the node about to be written
+  void separate(std::size_t depth) {
+    if (first_) {
+      return;
+    }
+    if (!breaks_.empty() && breaks_.back()) {
+      buf_.push_back('\n');
+      std::fill_n(std::back_inserter(buf_), depth * options_.indent, ' ');
+    } else {
+      buf_.push_back(' ');
+    }
+  }
+
+  // same text as formatting named tokens
+  template <typename Interner>
+  void write(const token& t, const Interner& interner) {
+    ely::visit(
+        [&]<typename T>(const T& x) {
+          if constexpr (std::same_as<T, int_literal>) {
+            auto str = fmt::format_int(x.value());
+            buf_.append(str.data(), str.data() + str.size());
+          } else if constexpr (std::same_as<T, float_literal>) {
+            fmt::format_to(std::back_inserter(buf_), "{}", x.value());
+          } else if constexpr (std::same_as<T, string_literal>) {
+            buf_.push_back('"');
+            append(x.value());
+            buf_.push_back('"');
+          } else {
+            append(interner.lookup(x.sym()));
+          }
+        },
+        t);
+  }
+};
+} // namespace green
+} // namespace ely
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <bit>
 #include <cstdint>
-#include <string>
+#include <functional>
+#include <string_view>
 
+#include "ely/origin.hpp"
+#include "ely/symbol.hpp"
 #include "ely/util/variant.hpp"
 #include "ely/util/visit.hpp"
 
@@ -11,57 +15,141 @@
 
 namespace ely {
 namespace green {
+namespace detail {
+// structural hashes of nodes are 32 bits, so they fit next to the origin
+// without growing the nodes
+constexpr std::uint32_t fold_hash(std::uint64_t h) {
+  return static_cast<std::uint32_t>(h ^ (h >> 32));
+}
+
+// std::hash isn't constexpr, nodes are hashed with plain arithmetic so they
+// can still be built in constant expressions
+constexpr std::uint64_t mix_hash(std::uint64_t seed, std::uint64_t v) {
+  auto h = seed ^ (v + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  return h;
+}
+
+// fnv-1a
+constexpr std::uint64_t bytes_hash(std::string_view s) {
+  std::uint64_t h = 0xcbf29ce484222325;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+// distinguishes equal values of different node kinds
+enum class hash_tag : std::uint64_t {
+  int_literal = 0x4e01,
+  float_literal,
+  string_literal,
+  identifier,
+  list,
+};
+
+constexpr std::uint32_t node_hash(hash_tag tag, std::uint64_t v) {
+  return fold_hash(mix_hash(static_cast<std::uint64_t>(tag), v));
+}
+} // namespace detail
+
+// every node caches a structural hash of its kind, value and children, which
+// ignores widths and origins. Nodes with different hashes are never
+// structurally equal.
+// Widths are stored in 32 bits like origins, a token is allocated for every
+// leaf of a tree so they are kept to 32 bytes.
 class int_literal {
-  void* token_;
+  ely::origin origin_; // start of the token itself, without atmosphere
+  std::uint32_t hash_;
+  std::uint32_t width_; // cached text width, including leading atmosphere
   std::int64_t value_;
 
 public:
-  explicit constexpr int_literal(std::int64_t val, void* token = nullptr)
-      : token_(token), value_(val) {}
+  explicit constexpr int_literal(std::int64_t val, std::size_t width = {},
+                                 ely::origin origin = {})
+      : origin_(origin),
+        hash_(detail::node_hash(detail::hash_tag::int_literal,
+                                  static_cast<std::uint64_t>(val))),
+        width_(static_cast<std::uint32_t>(width)), value_(val) {}
 
+  constexpr ely::origin origin() const { return origin_; }
+  constexpr std::uint32_t hash() const { return hash_; }
+  constexpr std::size_t width() const { return width_; }
   constexpr std::int64_t value() const { return value_; }
   constexpr operator std::int64_t() const { return value(); }
 };
 
 class float_literal {
-  void* token_;
+  ely::origin origin_;
   float value_;
+  std::uint32_t hash_; // of the bit pattern, like equality
+  std::uint32_t width_;
 
 public:
-  explicit constexpr float_literal(float f, void* token = nullptr)
-      : token_(token), value_(f) {}
+  explicit constexpr float_literal(float f, std::size_t width = {},
+                                   ely::origin origin = {})
+      : origin_(origin), value_(f),
+        hash_(detail::node_hash(detail::hash_tag::float_literal,
+                                std::bit_cast<std::uint32_t>(f))),
+        width_(static_cast<std::uint32_t>(width)) {}
 
+  constexpr ely::origin origin() const { return origin_; }
+  constexpr std::uint32_t hash() const { return hash_; }
+  constexpr std::size_t width() const { return width_; }
   constexpr float value() const { return value_; }
   constexpr operator float() const { return value(); }
 };
 
 class string_literal {
-  void* token_;
-  std::string value_;
+  ely::origin origin_;
+  std::uint32_t hash_;
+  std::uint32_t width_;
+  std::uint32_t size_;
+  // points into the source, or into an arena when escapes had to be replaced
+  const char* data_;
 
 public:
-  template <typename S>
-    requires(std::is_constructible_v<decltype(value_), S>)
-  explicit(!std::is_convertible_v<
-           S, decltype(value_)>) constexpr string_literal(S&& lit,
-                                                          void* token = nullptr)
-      : token_(token), value_(static_cast<S&&>(lit)) {}
-
-  constexpr std::string_view value() const { return value_; }
+  explicit constexpr string_literal(std::string_view lit,
+                                    std::size_t width = {},
+                                    ely::origin origin = {})
+      : origin_(origin),
+        hash_(detail::node_hash(detail::hash_tag::string_literal,
+                                  detail::bytes_hash(lit))),
+        width_(static_cast<std::uint32_t>(width)),
+        size_(static_cast<std::uint32_t>(lit.size())), data_(lit.data()) {}
+
+  constexpr ely::origin origin() const { return origin_; }
+  constexpr std::uint32_t hash() const { return hash_; }
+  constexpr std::size_t width() const { return width_; }
+  constexpr std::string_view value() const { return {data_, size_}; }
 };
 
+// the name points into the interner which produced the symbol
 class identifier {
-  void* token_;
-  std::string id_;
+  ely::origin origin_;
+  std::uint32_t width_;
+  ely::symbol sym_;
+  std::uint32_t size_;
+  const char* data_;
 
 public:
-  template <typename S>
-    requires(std::constructible_from<std::string, S>)
-  explicit(!std::convertible_to<S, std::string>) constexpr identifier(
-      S&& str, void* token = nullptr)
-      : token_(token), id_(static_cast<S&&>(str)) {}
+  explicit constexpr identifier(ely::symbol sym, std::string_view name,
+                                std::size_t width = {}, ely::origin origin = {})
+      : origin_(origin), width_(static_cast<std::uint32_t>(width)), sym_(sym),
+        size_(static_cast<std::uint32_t>(name.size())), data_(name.data()) {}
 
-  constexpr std::string_view value() const { return id_; }
+  constexpr ely::origin origin() const { return origin_; }
+  // of the symbol, only comparable within one interner. Computed instead of
+  // stored, which keeps identifiers at 24 bytes.
+  constexpr std::uint32_t hash() const {
+    return detail::node_hash(detail::hash_tag::identifier, sym_.id);
+  }
+  constexpr std::size_t width() const { return width_; }
+  constexpr ely::symbol sym() const { return sym_; }
+  constexpr std::string_view name() const { return {data_, size_}; }
 };
 
 namespace detail {
@@ -72,7 +160,56 @@ using token_variant = ely::variant<green::int_literal, green::float_literal,
 class token : public detail::token_variant {
 public:
   using detail::token_variant::token_variant;
+
+  constexpr std::size_t width() const {
+    return ely::visit([](const auto& t) -> std::size_t { return t.width(); },
+                      *this);
+  }
+
+  constexpr ely::origin origin() const {
+    return ely::visit([](const auto& t) { return t.origin(); }, *this);
+  }
+
+  constexpr std::uint32_t hash() const {
+    return ely::visit([](const auto& t) { return t.hash(); }, *this);
+  }
+};
+
+static_assert(sizeof(identifier) == 24);
+static_assert(sizeof(token) == 32);
+
+// a node together with the interner its identifiers were interned by, which
+// formats identifiers by looking their symbols up in the interner:
+//
+//   fmt::println("{}", named(root, interner));
+template <typename Node, typename Interner> struct named {
+  const Node& node;
+  const Interner& interner;
 };
+
+template <typename Node, typename Interner>
+named(const Node&, const Interner&) -> named<Node, Interner>;
+
+// same kind and value, ignoring widths and origins. Identifiers are compared
+// by symbol, so both tokens need to come from the same interner.
+constexpr bool structurally_equal(const token& lhs, const token& rhs) {
+  if (lhs.hash() != rhs.hash() || lhs.index() != rhs.index()) {
+    return false;
+  }
+  return ely::visit(
+      [&]<typename T>(const T& l) {
+        const auto& r = ely::get_unchecked<T>(rhs);
+        if constexpr (std::same_as<T, float_literal>) {
+          return std::bit_cast<std::uint32_t>(l.value()) ==
+                 std::bit_cast<std::uint32_t>(r.value());
+        } else if constexpr (std::same_as<T, identifier>) {
+          return l.sym() == r.sym();
+        } else {
+          return l.value() == r.value();
+        }
+      },
+      lhs);
+}
 } // namespace green
 } // namespace ely
 
@@ -106,6 +243,7 @@ template <> struct fmt::formatter<ely::green::string_literal> {
   }
 };
 
+// prints the name, format sym() for the symbol
 template <> struct fmt::formatter<ely::green::identifier> {
   constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
 
@@ -113,7 +251,22 @@ template <> struct fmt::formatter<ely::green::identifier> {
   constexpr auto format(const ely::green::identifier& id, FmtCtx& ctx) const {
     // TODO handle escaping identifiers with uncommon values, such as spaces or
     // tabs
-    return fmt::format_to(ctx.out(), "{}", id.value());
+    return fmt::format_to(ctx.out(), "{}", id.name());
+  }
+};
+
+template <typename Interner>
+struct fmt::formatter<ely::green::named<ely::green::identifier, Interner>> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto
+  format(const ely::green::named<ely::green::identifier, Interner>& id,
+         FmtCtx& ctx) const {
+    // TODO handle escaping identifiers with uncommon values, such as spaces or
+    // tabs
+    return fmt::format_to(ctx.out(), "{}",
+                          id.interner.lookup(id.node.sym()));
   }
 };
 
@@ -130,3 +283,24 @@ template <> struct fmt::formatter<ely::green::token> {
         t);
   }
 };
+
+template <typename Interner>
+struct fmt::formatter<ely::green::named<ely::green::token, Interner>> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto format(const ely::green::named<ely::green::token, Interner>& t,
+                        FmtCtx& ctx) const {
+    return ely::visit(
+        [&]<typename T>(const T& x) {
+          if constexpr (std::same_as<T, ely::green::identifier>) {
+            auto fmt = ::fmt::formatter<ely::green::named<T, Interner>>{};
+            return fmt.format(ely::green::named(x, t.interner), ctx);
+          } else {
+            auto fmt = ::fmt::formatter<T>{};
+            return fmt.format(x, ctx);
+          }
+        },
+        t.node);
+  }
+};
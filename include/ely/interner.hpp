@@ -8,7 +8,6 @@
 #include <vector>
 
 #include "ely/arena/growing.hpp"
-#include "ely/hash/fnv.hpp"
 #include "ely/symbol.hpp"
 #include "ely/util/cx_or_rt.hpp"
 #include "ely/util/optional.hpp"
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ely {
+namespace io {
+// read only memory mapping of an entire file, pages are only read once they
+// are touched.
+class mapped_file {
+  void* data_ = nullptr;
+  std::size_t size_ = 0;
+
+public:
+  mapped_file() = default;
+
+  explicit mapped_file(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      auto size = static_cast<std::size_t>(st.st_size);
+      void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = data;
+        size_ = size;
+      }
+    }
+
+    // the mapping keeps the file alive
+    ::close(fd);
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  mapped_file(mapped_file&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  mapped_file& operator=(mapped_file&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  ~mapped_file() {
+    if (data_) {
+      ::munmap(data_, size_);
+    }
+  }
+
+  explicit operator bool() const { return data_ != nullptr; }
+
+  std::span<const std::byte> bytes() const {
+    return {static_cast<const std::byte*>(data_), size_};
+  }
+};
+} // namespace io
+} // namespace ely
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/base.h>
+
+namespace ely {
+// a position in some source file as 32 bits. Every file registered with a
+// source_map occupies its own range of positions, so an origin identifies the
+// file as well as the offset within it. 0 is reserved for nodes without an
+// origin.
+class origin {
+  std::uint32_t pos_ = 0;
+
+public:
+  constexpr origin() = default;
+  explicit constexpr origin(std::uint32_t pos) : pos_(pos) {}
+
+  constexpr std::uint32_t raw() const { return pos_; }
+
+  explicit constexpr operator bool() const { return pos_ != 0; }
+
+  // offset bytes further into the same file, stays empty without an origin
+  constexpr origin operator+(std::size_t offset) const {
+    if (pos_ == 0) {
+      return *this;
+    }
+    assert(offset <= std::numeric_limits<std::uint32_t>::max() - pos_);
+    return origin(pos_ + static_cast<std::uint32_t>(offset));
+  }
+
+  friend constexpr bool operator==(origin, origin) = default;
+  friend constexpr auto operator<=>(origin, origin) = default;
+};
+
+static_assert(sizeof(origin) == 4);
+
+// the position table origins refer to. Files are only registered, their
+// line starts are computed the first time a position in them is resolved.
+// The text of every file must outlive the map.
+class source_map {
+public:
+  using file_id = std::uint32_t;
+
+  struct location {
+    file_id file;
+    std::uint32_t offset;
+  };
+
+  // 1 based
+  struct line_column {
+    std::string_view file_name;
+    std::uint32_t line;
+    std::uint32_t column;
+  };
+
+private:
+  struct file {
+    std::string name;
+    std::string_view text;
+    std::uint32_t start;
+    mutable std::vector<std::uint32_t> lines; // offset of every line
+  };
+
+  std::vector<file> files_;
+  std::uint32_t next_ = 1;
+
+public:
+  // origin of the first byte of text. Positions up to and including the end
+  // of text are reserved, so eof has an origin as well.
+  origin add_file(std::string name, std::string_view text) {
+    assert(text.size() < std::numeric_limits<std::uint32_t>::max() - next_ &&
+           "source_map exhausted the 32 bit position space");
+    auto start = next_;
+    files_.push_back(file{std::move(name), text, start, {}});
+    next_ += static_cast<std::uint32_t>(text.size()) + 1;
+    return origin(start);
+  }
+
+  std::size_t size() const { return files_.size(); }
+
+  std::string_view name(file_id id) const { return files_[id].name; }
+  std::string_view text(file_id id) const { return files_[id].text; }
+
+  // files are sorted by their start, the containing file is found by a binary
+  // search
+  location locate(origin o) const {
+    assert(o && o.raw() < next_);
+    auto it = std::ranges::upper_bound(files_, o.raw(), {}, &file::start);
+    auto id = static_cast<file_id>(it - files_.begin()) - 1;
+    return location{id, o.raw() - files_[id].start};
+  }
+
+  line_column resolve(origin o) const {
+    auto loc = locate(o);
+    const auto& f = files_[loc.file];
+    if (f.lines.empty()) {
+      f.lines.push_back(0);
+      for (std::size_t i = 0; i != f.text.size(); ++i) {
+        if (f.text[i] == '\n') {
+          f.lines.push_back(static_cast<std::uint32_t>(i + 1));
+        }
+      }
+    }
+
+    auto it = std::ranges::upper_bound(f.lines, loc.offset);
+    auto line = static_cast<std::uint32_t>(it - f.lines.begin());
+    return line_column{f.name, line, loc.offset - *std::prev(it) + 1};
+  }
+};
+} // namespace ely
+
+template <> struct fmt::formatter<ely::origin> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto format(const ely::origin& o, FmtCtx& ctx) const {
+    if (o) {
+      return fmt::format_to(ctx.out(), "origin({})", o.raw());
+    }
+    return fmt::format_to(ctx.out(), "origin(none)");
+  }
+};
+
+template <> struct fmt::formatter<ely::source_map::line_column> {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  template <typename FmtCtx>
+  constexpr auto format(const ely::source_map::line_column& lc,
+                        FmtCtx& ctx) const {
+    return fmt::format_to(ctx.out(), "{}:{}:{}", lc.file_name, lc.line,
+                          lc.column);
+  }
+};
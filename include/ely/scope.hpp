@@ -1,22 +1,38 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <expected>
+#include <functional>
+#include <memory>
 #include <ranges>
 #include <set>
 #include <span>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 
+#include "ely/arena/growing.hpp"
+#include "ely/symbol.hpp"
+#include "ely/symbol_map.hpp"
+#include "ely/util/hash.hpp"
+#include "ely/util/sorted_set.hpp"
+
 namespace ely {
 class scope_generator;
+class scope_pool;
 
 class scope {
   friend class scope_generator;
+  friend class scope_pool;
 
 private:
   unsigned id_;
@@ -49,9 +65,90 @@ public:
   constexpr scope next() { return this->operator()(); }
 };
 
-// TODO: this is currently quite expensive to copy, this should be memoized or
-// uniqued, we'll have to implement a basic_scope_set_storage and similar
-class scope_set {
+// shares the scope id space between threads. Every thread generates scopes
+// from its own generator, which reserves ids from the pool a block at a time,
+// so the shared counter is only touched once per block.
+class scope_pool {
+  std::atomic<unsigned> reserved_{0}; // ids up to and including are taken
+  unsigned block_size_;
+
+public:
+  // not synchronized, every thread needs its own
+  class generator {
+    friend class scope_pool;
+
+  private:
+    scope_pool* pool_;
+    unsigned current_ = 0; // last generated id
+    unsigned end_ = 0;     // last id of the reserved block
+
+    explicit generator(scope_pool& pool) : pool_(std::addressof(pool)) {}
+
+  public:
+    scope operator()() {
+      if (current_ == end_) {
+        current_ = pool_->reserve();
+        end_ = current_ + pool_->block_size_;
+      }
+      return make_scope(++current_);
+    }
+
+    scope next() { return this->operator()(); }
+  };
+
+  explicit scope_pool(unsigned block_size = 256) : block_size_(block_size) {
+    assert(block_size != 0);
+  }
+
+  scope_pool(const scope_pool&) = delete;
+  scope_pool& operator=(const scope_pool&) = delete;
+
+  generator make_generator() { return generator(*this); }
+
+private:
+  static scope make_scope(unsigned id) { return scope{id}; }
+
+  // the id before a fresh block
+  unsigned reserve() {
+    return reserved_.fetch_add(block_size_, std::memory_order_relaxed);
+  }
+};
+
+namespace detail {
+// sorts scopes by id and removes duplicates in place, returns the number of
+// scopes kept. When flipping, a scope occurring twice cancels out.
+template <typename T>
+std::size_t sort_unique_scopes(std::span<T> scopes, bool flip) {
+  std::ranges::sort(scopes, {},
+                    [](T x) { return std::bit_cast<unsigned>(x); });
+  std::size_t kept = 0;
+  for (std::size_t i = 0, j = 0; i != scopes.size(); i = j) {
+    while (j != scopes.size() && scopes[j] == scopes[i]) {
+      ++j;
+    }
+    if (!flip || (j - i) % 2 == 1) {
+      scopes[kept++] = scopes[i];
+    }
+  }
+  return kept;
+}
+
+// scopes sorted by id and without duplicates, as T which is either scope or
+// the id
+template <typename T>
+void sorted_scopes(std::span<const scope> scopes, bool flip,
+                   std::vector<T>& out) {
+  out.clear();
+  for (auto sc : scopes) {
+    out.push_back(std::bit_cast<T>(sc));
+  }
+  out.resize(sort_unique_scopes(std::span<T>(out), flip));
+}
+} // namespace detail
+
+// a standalone scope set with a node per scope, kept as a reference for
+// small_scope_set. Every operation copies the whole set.
+class tree_scope_set {
 public:
   using const_iterator = typename std::set<scope>::const_iterator;
 
@@ -59,16 +156,17 @@ private:
   std::set<scope> set_;
 
 public:
-  scope_set() = default;
-  scope_set(std::initializer_list<scope> il) : set_(il) {}
+  tree_scope_set() = default;
+  tree_scope_set(std::initializer_list<scope> il) : set_(il) {}
 
   std::size_t size() const { return set_.size(); }
   const_iterator begin() const { return set_.begin(); }
   const_iterator end() const { return set_.end(); }
 
-  friend bool operator==(const scope_set& lhs, const scope_set& rhs) = default;
+  friend bool operator==(const tree_scope_set& lhs,
+                         const tree_scope_set& rhs) = default;
 
-  bool subset_of(const scope_set& other) const {
+  bool subset_of(const tree_scope_set& other) const {
     // checks this set is a subset (subsequence) of other.
     return std::includes(other.begin(), other.end(), begin(), end());
   }
@@ -76,29 +174,29 @@ public:
   bool has_scope(const scope& sc) const { return set_.find(sc) != set_.end(); }
 
   [[nodiscard]]
-  scope_set add_scope(const scope& sc) const {
-    scope_set res = *this;
+  tree_scope_set add_scope(const scope& sc) const {
+    tree_scope_set res = *this;
     res.set_.insert(sc);
     return res;
   }
 
   [[nodiscard]]
-  scope_set add_scopes(std::span<scope> scopes) const {
-    scope_set res = *this;
+  tree_scope_set add_scopes(std::span<scope> scopes) const {
+    tree_scope_set res = *this;
     res.set_.insert(scopes.begin(), scopes.end());
     return res;
   }
 
   [[nodiscard]]
-  scope_set remove_scope(const scope& sc) const {
-    scope_set res = *this;
+  tree_scope_set remove_scope(const scope& sc) const {
+    tree_scope_set res = *this;
     res.set_.erase(sc);
     return res;
   }
 
   [[nodiscard]]
-  scope_set remove_scopes(std::span<scope> scopes) const {
-    scope_set res = *this;
+  tree_scope_set remove_scopes(std::span<scope> scopes) const {
+    tree_scope_set res = *this;
     for (const auto& sc : scopes) {
       res.set_.erase(sc);
     }
@@ -106,7 +204,7 @@ public:
   }
 
   [[nodiscard]]
-  scope_set flip_scope(const scope& sc) const {
+  tree_scope_set flip_scope(const scope& sc) const {
     if (has_scope(sc)) {
       return remove_scope(sc);
     } else {
@@ -115,7 +213,7 @@ public:
   }
 
   [[nodiscard]]
-  scope_set flip_scopes(std::span<scope> scopes) const {
+  tree_scope_set flip_scopes(std::span<scope> scopes) const {
     auto res = *this;
     for (const auto& sc : scopes) {
       if (res.has_scope(sc)) {
@@ -128,6 +226,559 @@ public:
   }
 };
 
+// a standalone scope set as a sorted array of scopes, stored inline for up to
+// N scopes and on the heap beyond that. Lookups and set operations are linear
+// merges over contiguous memory, which beats searching for the few scopes
+// most identifiers carry. Every operation copies the set, expansion should
+// use the interned sets of scope_set_table instead.
+template <std::size_t N> class small_scope_set {
+public:
+  using const_iterator = const scope*;
+
+private:
+  std::uint32_t size_ = 0;
+  std::unique_ptr<scope[]> heap_; // set once size_ exceeds N
+  std::array<scope, N> inline_;
+
+public:
+  small_scope_set() = default;
+  small_scope_set(std::initializer_list<scope> il) {
+    std::vector<scope> scopes(il);
+    std::ranges::sort(scopes, {}, &scope::id);
+    auto dups = std::ranges::unique(scopes);
+    scopes.erase(dups.begin(), dups.end());
+    resize(scopes.size());
+    std::ranges::copy(scopes, data());
+  }
+
+  small_scope_set(const small_scope_set& other) {
+    resize(other.size());
+    std::ranges::copy(other, data());
+  }
+
+  // leaves other empty, only the inline scopes in use are copied
+  small_scope_set(small_scope_set&& other) noexcept
+      : size_(std::exchange(other.size_, 0)), heap_(std::move(other.heap_)) {
+    if (!heap_) {
+      std::copy_n(other.inline_.data(), size_, inline_.data());
+    }
+  }
+
+  small_scope_set& operator=(const small_scope_set& other) {
+    if (this != &other) {
+      resize(other.size());
+      std::ranges::copy(other, data());
+    }
+    return *this;
+  }
+
+  small_scope_set& operator=(small_scope_set&& other) noexcept {
+    if (this != &other) {
+      size_ = std::exchange(other.size_, 0);
+      heap_ = std::move(other.heap_);
+      if (!heap_) {
+        std::copy_n(other.inline_.data(), size_, inline_.data());
+      }
+    }
+    return *this;
+  }
+
+  std::size_t size() const { return size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  std::span<const scope> scopes() const { return {data(), size_}; }
+
+  friend bool operator==(const small_scope_set& lhs,
+                         const small_scope_set& rhs) {
+    return std::ranges::equal(lhs, rhs);
+  }
+
+  bool subset_of(const small_scope_set& other) const {
+    return sorted_set::includes(other.scopes(), scopes());
+  }
+
+  // number of scopes in both sets
+  std::size_t intersection_size(const small_scope_set& other) const {
+    return sorted_set::intersection_size(scopes(), other.scopes());
+  }
+
+  bool has_scope(const scope& sc) const {
+    auto pos = lower_bound(sc);
+    return pos != size_ && data()[pos] == sc;
+  }
+
+  [[nodiscard]]
+  small_scope_set add_scope(const scope& sc) const {
+    auto pos = lower_bound(sc);
+    if (pos != size_ && data()[pos] == sc) {
+      return *this;
+    }
+    small_scope_set res;
+    res.resize(size_ + 1);
+    std::copy(begin(), begin() + pos, res.data());
+    res.data()[pos] = sc;
+    std::copy(begin() + pos, end(), res.data() + pos + 1);
+    return res;
+  }
+
+  [[nodiscard]]
+  small_scope_set add_scopes(std::span<scope> scopes) const {
+    return merge(scopes, false, sorted_set::set_union<scope>);
+  }
+
+  [[nodiscard]]
+  small_scope_set remove_scope(const scope& sc) const {
+    auto pos = lower_bound(sc);
+    if (pos == size_ || data()[pos] != sc) {
+      return *this;
+    }
+    small_scope_set res;
+    res.resize(size_ - 1);
+    std::copy(begin(), begin() + pos, res.data());
+    std::copy(begin() + pos + 1, end(), res.data() + pos);
+    return res;
+  }
+
+  [[nodiscard]]
+  small_scope_set remove_scopes(std::span<scope> scopes) const {
+    return merge(scopes, false, sorted_set::set_difference<scope>);
+  }
+
+  [[nodiscard]]
+  small_scope_set flip_scope(const scope& sc) const {
+    if (has_scope(sc)) {
+      return remove_scope(sc);
+    } else {
+      return add_scope(sc);
+    }
+  }
+
+  [[nodiscard]]
+  small_scope_set flip_scopes(std::span<scope> scopes) const {
+    return merge(scopes, true, sorted_set::set_symmetric_difference<scope>);
+  }
+
+private:
+  const scope* data() const { return heap_ ? heap_.get() : inline_.data(); }
+  scope* data() { return heap_ ? heap_.get() : inline_.data(); }
+
+  // discards the contents
+  void resize(std::size_t size) {
+    if (size > N) {
+      heap_ = std::make_unique_for_overwrite<scope[]>(size);
+    } else {
+      heap_.reset();
+    }
+    size_ = static_cast<std::uint32_t>(size);
+  }
+
+  // number of scopes less than sc. At most N inline scopes are counted
+  // without branching on them, spilled sets are binary searched.
+  std::size_t lower_bound(const scope& sc) const {
+    if (heap_) {
+      auto it = std::ranges::lower_bound(scopes(), sc.id(), {}, &scope::id);
+      return static_cast<std::size_t>(it - begin());
+    }
+
+    std::size_t pos = 0;
+    for (auto s : scopes()) {
+      pos += s.id() < sc.id();
+    }
+    return pos;
+  }
+
+  // keeps the first size scopes, moving them inline once they fit
+  void shrink(std::size_t size) {
+    if (heap_ && size <= N) {
+      std::copy_n(heap_.get(), size, inline_.data());
+      heap_.reset();
+    }
+    size_ = static_cast<std::uint32_t>(size);
+  }
+
+  // op merges this with the sorted scopes into an output pointer. Few scopes
+  // are sorted on the stack and the result is written straight into the new
+  // set, the heap is only used once either doesn't fit inline.
+  template <typename Op>
+  small_scope_set merge(std::span<scope> scopes, bool flip, Op op) const {
+    std::array<scope, N> buffer;
+    std::vector<scope> spilled;
+    std::span<const scope> sorted;
+    if (scopes.size() <= N) {
+      auto first = std::span(buffer).first(scopes.size());
+      std::ranges::copy(scopes, first.begin());
+      sorted = first.first(detail::sort_unique_scopes(first, flip));
+    } else {
+      detail::sorted_scopes(scopes, flip, spilled);
+      sorted = spilled;
+    }
+
+    small_scope_set res;
+    res.resize(size() + sorted.size());
+    auto* last = op(this->scopes(), sorted, res.data());
+    res.shrink(static_cast<std::size_t>(last - res.data()));
+    return res;
+  }
+};
+
+using scope_set = small_scope_set<4>;
+
+// sorted, unique scope ids, the key scope sets are interned by
+struct scope_ids {
+  std::span<const std::uint32_t> ids;
+
+  friend constexpr bool operator==(const scope_ids& lhs,
+                                   const scope_ids& rhs) {
+    return std::ranges::equal(lhs.ids, rhs.ids);
+  }
+};
+} // namespace ely
+
+template <> struct std::hash<ely::scope_ids> {
+  std::size_t operator()(const ely::scope_ids& s) const {
+    auto h = s.ids.size();
+    for (auto id : s.ids) {
+      h = ely::hash_combine_seed(h, id);
+    }
+    return h;
+  }
+};
+
+namespace ely {
+class scope_set_table;
+
+// a scope set interned in a scope_set_table. Equal sets of the same table
+// have equal handles, so comparing sets is comparing handles.
+class scope_set_handle {
+  friend class scope_set_table;
+
+private:
+  std::uint32_t id_ = 0; // the empty set
+
+  explicit constexpr scope_set_handle(std::uint32_t id) : id_(id) {}
+
+public:
+  // the empty set
+  scope_set_handle() = default;
+
+  constexpr std::uint32_t id() const { return id_; }
+
+  friend bool operator==(const scope_set_handle&,
+                         const scope_set_handle&) = default;
+};
+
+static_assert(sizeof(scope_set_handle) == 4);
+} // namespace ely
+
+template <> struct std::hash<ely::scope_set_handle> {
+  std::size_t operator()(const ely::scope_set_handle& ss) const {
+    return std::hash<std::uint32_t>{}(ss.id());
+  }
+};
+
+namespace ely {
+// changes to scope sets which haven't been applied yet: scopes to add, to
+// remove and to flip. The three sets are disjoint, so the order they are
+// applied in doesn't matter.
+struct scope_ops {
+  scope_set_handle add;
+  scope_set_handle remove;
+  scope_set_handle flip;
+
+  constexpr bool empty() const {
+    return add == scope_set_handle() && remove == scope_set_handle() &&
+           flip == scope_set_handle();
+  }
+
+  friend bool operator==(const scope_ops&, const scope_ops&) = default;
+};
+
+// owns every scope set created during an expansion. Sets are stored once as
+// sorted arrays of scope ids, uniqued by their contents, and never change.
+// Adding, removing and flipping a single scope is memoized per (set, scope),
+// and operations between two sets per pair of sets, so repeating an operation
+// on the same sets only costs a hash lookup.
+class scope_set_table {
+private:
+  // handles by contents, keys refer to the copies in arena_
+  std::unordered_map<scope_ids, std::uint32_t> interned_;
+  std::vector<scope_ids> sets_; // indexed by handle
+  ely::arena::growing arena_{4096};
+  std::unordered_map<std::uint64_t, std::uint32_t> added_;
+  std::unordered_map<std::uint64_t, std::uint32_t> removed_;
+  std::unordered_map<std::uint64_t, std::uint32_t> united_;
+  std::unordered_map<std::uint64_t, std::uint32_t> subtracted_;
+  std::unordered_map<std::uint64_t, std::uint32_t> intersected_;
+  std::unordered_map<std::uint64_t, std::uint32_t> differed_;
+  std::vector<std::uint32_t> scratch_;
+  std::vector<std::uint32_t> sorted_;
+
+public:
+  scope_set_table() {
+    auto empty = intern_sorted({});
+    assert(empty == scope_set_handle());
+    (void)empty;
+  }
+
+  scope_set_table(const scope_set_table&) = delete;
+  scope_set_table& operator=(const scope_set_table&) = delete;
+
+  // number of distinct sets
+  std::size_t size() const { return sets_.size(); }
+
+  std::span<const std::uint32_t> ids(scope_set_handle ss) const {
+    return sets_[ss.id_].ids;
+  }
+
+  std::size_t size(scope_set_handle ss) const { return ids(ss).size(); }
+
+  bool has_scope(scope_set_handle ss, scope sc) const {
+    return std::ranges::binary_search(ids(ss), sc.id());
+  }
+
+  bool subset_of(scope_set_handle ss, scope_set_handle other) const {
+    if (ss == other) {
+      return true;
+    }
+    return sorted_set::includes(ids(other), ids(ss));
+  }
+
+  // number of scopes in both sets
+  std::size_t intersection_size(scope_set_handle ss,
+                                scope_set_handle other) const {
+    return ss == other ? size(ss)
+                       : sorted_set::intersection_size(ids(ss), ids(other));
+  }
+
+  scope_set_handle make(std::span<const scope> scopes) {
+    scratch_.clear();
+    for (auto sc : scopes) {
+      scratch_.push_back(sc.id());
+    }
+    std::ranges::sort(scratch_);
+    auto dups = std::ranges::unique(scratch_);
+    scratch_.erase(dups.begin(), dups.end());
+    return intern_sorted(scratch_);
+  }
+
+  scope_set_handle make(std::initializer_list<scope> scopes) {
+    return make(std::span(scopes.begin(), scopes.size()));
+  }
+
+  [[nodiscard]]
+  scope_set_handle add_scope(scope_set_handle ss, scope sc) {
+    return memoized(added_, key(ss, sc), [&] {
+      auto src = ids(ss);
+      auto pos = std::ranges::lower_bound(src, sc.id());
+      if (pos != src.end() && *pos == sc.id()) {
+        return ss;
+      }
+      scratch_.assign(src.begin(), pos);
+      scratch_.push_back(sc.id());
+      scratch_.insert(scratch_.end(), pos, src.end());
+      return intern_sorted(scratch_);
+    });
+  }
+
+  [[nodiscard]]
+  scope_set_handle remove_scope(scope_set_handle ss, scope sc) {
+    return memoized(removed_, key(ss, sc), [&] {
+      auto src = ids(ss);
+      auto pos = std::ranges::lower_bound(src, sc.id());
+      if (pos == src.end() || *pos != sc.id()) {
+        return ss;
+      }
+      scratch_.assign(src.begin(), pos);
+      scratch_.insert(scratch_.end(), std::next(pos), src.end());
+      return intern_sorted(scratch_);
+    });
+  }
+
+  [[nodiscard]]
+  scope_set_handle flip_scope(scope_set_handle ss, scope sc) {
+    return has_scope(ss, sc) ? remove_scope(ss, sc) : add_scope(ss, sc);
+  }
+
+  // a single scope goes through the memoized operation, more are merged
+  // with the set at once
+  [[nodiscard]]
+  scope_set_handle add_scopes(scope_set_handle ss, std::span<scope> scopes) {
+    if (scopes.size() == 1) {
+      return add_scope(ss, scopes.front());
+    }
+    return merge(ss, scopes, false, sorted_set::set_union<std::uint32_t>);
+  }
+
+  [[nodiscard]]
+  scope_set_handle remove_scopes(scope_set_handle ss,
+                                 std::span<scope> scopes) {
+    if (scopes.size() == 1) {
+      return remove_scope(ss, scopes.front());
+    }
+    return merge(ss, scopes, false,
+                 sorted_set::set_difference<std::uint32_t>);
+  }
+
+  [[nodiscard]]
+  scope_set_handle flip_scopes(scope_set_handle ss, std::span<scope> scopes) {
+    if (scopes.size() == 1) {
+      return flip_scope(ss, scopes.front());
+    }
+    return merge(ss, scopes, true,
+                 sorted_set::set_symmetric_difference<std::uint32_t>);
+  }
+
+  [[nodiscard]]
+  scope_set_handle unite(scope_set_handle a, scope_set_handle b) {
+    if (a == b || b == scope_set_handle()) {
+      return a;
+    }
+    if (a == scope_set_handle()) {
+      return b;
+    }
+    return combine(united_, a, b, sorted_set::set_union<std::uint32_t>);
+  }
+
+  // scopes of a which aren't in b
+  [[nodiscard]]
+  scope_set_handle subtract(scope_set_handle a, scope_set_handle b) {
+    if (a == b) {
+      return {};
+    }
+    if (a == scope_set_handle() || b == scope_set_handle()) {
+      return a;
+    }
+    return combine(subtracted_, a, b,
+                   sorted_set::set_difference<std::uint32_t>);
+  }
+
+  [[nodiscard]]
+  scope_set_handle intersect(scope_set_handle a, scope_set_handle b) {
+    if (a == b) {
+      return a;
+    }
+    if (a == scope_set_handle() || b == scope_set_handle()) {
+      return {};
+    }
+    return combine(intersected_, a, b,
+                   sorted_set::set_intersection<std::uint32_t>);
+  }
+
+  // scopes in exactly one of a and b, flipping every scope of b in a
+  [[nodiscard]]
+  scope_set_handle symmetric_difference(scope_set_handle a,
+                                        scope_set_handle b) {
+    if (a == b) {
+      return {};
+    }
+    if (b == scope_set_handle()) {
+      return a;
+    }
+    if (a == scope_set_handle()) {
+      return b;
+    }
+    return combine(differed_, a, b,
+                   sorted_set::set_symmetric_difference<std::uint32_t>);
+  }
+
+  scope_ops adding(scope sc) { return scope_ops{make({sc}), {}, {}}; }
+  scope_ops removing(scope sc) { return scope_ops{{}, make({sc}), {}}; }
+  scope_ops flipping(scope sc) { return scope_ops{{}, {}, make({sc})}; }
+
+  [[nodiscard]]
+  scope_set_handle apply(scope_set_handle ss, const scope_ops& ops) {
+    ss = subtract(unite(ss, ops.add), ops.remove);
+    return symmetric_difference(ss, ops.flip);
+  }
+
+  // the operations of applying first and then then. For every scope the last
+  // add or remove wins, a flip turns a pending add into a remove and the
+  // other way around, and two flips cancel.
+  [[nodiscard]]
+  scope_ops compose(const scope_ops& first, const scope_ops& then) {
+    if (first.empty()) {
+      return then;
+    }
+    if (then.empty()) {
+      return first;
+    }
+    auto add = unite(subtract(subtract(first.add, then.remove), then.flip),
+                     then.add);
+    auto remove = unite(
+        subtract(subtract(first.remove, then.add), then.flip), then.remove);
+    auto flip = symmetric_difference(
+        subtract(subtract(first.flip, then.add), then.remove),
+        subtract(subtract(then.flip, first.add), first.remove));
+    return scope_ops{unite(add, intersect(then.flip, first.remove)),
+                     unite(remove, intersect(then.flip, first.add)), flip};
+  }
+
+private:
+  static std::uint64_t key(scope_set_handle ss, scope sc) {
+    return (std::uint64_t{ss.id_} << 32) | sc.id();
+  }
+
+  static std::uint64_t key(scope_set_handle a, scope_set_handle b) {
+    return (std::uint64_t{a.id_} << 32) | b.id_;
+  }
+
+  template <typename F>
+  scope_set_handle
+  memoized(std::unordered_map<std::uint64_t, std::uint32_t>& memo,
+           std::uint64_t key, F compute) {
+    if (auto it = memo.find(key); it != memo.end()) {
+      return scope_set_handle(it->second);
+    }
+    auto res = compute();
+    memo.emplace(key, res.id_);
+    return res;
+  }
+
+  // op merges the ids of a and b into an output pointer
+  template <typename Op>
+  scope_set_handle
+  combine(std::unordered_map<std::uint64_t, std::uint32_t>& memo,
+          scope_set_handle a, scope_set_handle b, Op op) {
+    return memoized(memo, key(a, b), [&] {
+      auto lhs = ids(a);
+      auto rhs = ids(b);
+      scratch_.resize(lhs.size() + rhs.size());
+      auto* last = op(lhs, rhs, scratch_.data());
+      scratch_.resize(static_cast<std::size_t>(last - scratch_.data()));
+      return intern_sorted(scratch_);
+    });
+  }
+
+  // op merges the ids of ss with the sorted ids of scopes into an output
+  // pointer
+  template <typename Op>
+  scope_set_handle merge(scope_set_handle ss, std::span<const scope> scopes,
+                         bool flip, Op op) {
+    detail::sorted_scopes(scopes, flip, sorted_);
+    auto src = ids(ss);
+    scratch_.resize(src.size() + sorted_.size());
+    auto* last = op(src, sorted_, scratch_.data());
+    scratch_.resize(static_cast<std::size_t>(last - scratch_.data()));
+    return intern_sorted(scratch_);
+  }
+
+  // ids must be sorted and unique
+  scope_set_handle intern_sorted(std::span<const std::uint32_t> ids) {
+    if (auto it = interned_.find(scope_ids{ids}); it != interned_.end()) {
+      return scope_set_handle(it->second);
+    }
+
+    // the key refers to the copy owned by the table
+    auto* copy = arena_.allocate<std::uint32_t>(ids.size());
+    std::ranges::copy(ids, copy);
+    auto key = scope_ids{{copy, ids.size()}};
+    auto id = static_cast<std::uint32_t>(sets_.size());
+    sets_.push_back(key);
+    interned_.emplace(key, id);
+    return scope_set_handle(id);
+  }
+};
+
 enum struct lookup_error { key_not_found, scope_not_found, ambiguous };
 
 template <typename Id, typename V> struct binding {
@@ -138,6 +789,57 @@ template <typename Id, typename V> struct binding {
   constexpr V& value() { return val; }
 };
 
+namespace detail {
+constexpr std::uint64_t signature_bit(std::uint32_t id) {
+  auto h = std::uint64_t{id} * 0x9e3779b97f4a7c15;
+  return std::uint64_t{1} << (h >> 58);
+}
+
+// a 64 bit bloom filter of the scopes of a set, a set can only be a subset of
+// another if its signature is
+template <typename ScopeSet>
+constexpr std::uint64_t scope_signature(const ScopeSet& ss) {
+  std::uint64_t res = 0;
+  for (const scope& sc : ss) {
+    res |= signature_bit(sc.id());
+  }
+  return res;
+}
+
+// of an interned set
+constexpr std::uint64_t scope_signature(std::span<const std::uint32_t> ids) {
+  std::uint64_t res = 0;
+  for (auto id : ids) {
+    res |= signature_bit(id);
+  }
+  return res;
+}
+
+// interned symbols index a symbol_map directly, other symbols are hashed
+template <typename Symbol, typename T>
+using symbol_table =
+    std::conditional_t<std::is_same_v<Symbol, ely::symbol>, symbol_map<T>,
+                       std::unordered_map<Symbol, T>>;
+
+template <typename T> T* find_symbol(symbol_map<T>& map, ely::symbol sym) {
+  return map.find(sym);
+}
+
+template <typename Symbol, typename T>
+T* find_symbol(std::unordered_map<Symbol, T>& map, const Symbol& sym) {
+  auto it = map.find(sym);
+  return it != map.end() ? &it->second : nullptr;
+}
+
+// symbols ordered by id, the order their entries have in a symbol_map
+constexpr bool symbol_less(ely::symbol a, ely::symbol b) { return a.id < b.id; }
+
+template <typename Symbol>
+constexpr bool symbol_less(const Symbol& a, const Symbol& b) {
+  return std::ranges::less{}(a, b);
+}
+} // namespace detail
+
 template <typename Id, typename V> class binding_map {
 public:
   using binding_type = binding<Id, V>;
@@ -146,67 +848,255 @@ public:
       std::remove_cvref_t<decltype(std::declval<Id>().symbol())>;
 
 private:
-  std::unordered_map<symbol_type, std::vector<value_type>> map_;
+  // the bindings of a symbol sorted by the size of their scope set,
+  // descending, with the signature of every set
+  struct symbol_bindings {
+    std::vector<value_type> values;
+    std::vector<std::uint64_t> signatures;
+  };
+
+  // a lookup result, only valid while its generation is the current one
+  struct cached_lookup {
+    std::uint64_t generation;
+    std::expected<const value_type*, lookup_error> result;
+  };
+
+  struct cache_key {
+    symbol_type symbol;
+    scope_set_handle ss;
+
+    friend bool operator==(const cache_key&, const cache_key&) = default;
+  };
+
+  struct cache_key_hash {
+    std::size_t operator()(const cache_key& key) const {
+      return ely::hash_combine(key.symbol, key.ss);
+    }
+  };
+
+  detail::symbol_table<symbol_type, symbol_bindings> map_;
+  std::unordered_map<cache_key, cached_lookup, cache_key_hash> cache_;
+  // bumped by every insert, which invalidates every cached lookup at once
+  std::uint64_t generation_ = 0;
+  std::size_t hits_ = 0;
+  std::size_t misses_ = 0;
+  // scratch space of resolve_all, kept to reuse its storage
+  struct resolve_scratch {
+    // the first occurrence of every distinct pair
+    std::vector<std::uint32_t> firsts;
+    // the distinct pair of every occurrence
+    std::vector<std::uint32_t> pairs;
+    // distinct pairs by hash, open addressing
+    std::vector<std::uint32_t> buckets;
+    // distinct pairs in order of symbol, then scope set
+    std::vector<std::uint32_t> order;
+    std::vector<std::expected<const value_type*, lookup_error>> results;
+  } scratch_;
 
 public:
   binding_map() = default;
 
+  std::uint64_t generation() const { return generation_; }
+  std::size_t cache_hits() const { return hits_; }
+  std::size_t cache_misses() const { return misses_; }
+
+  // returns false and leaves the map alone if the symbol of id is already
+  // bound with the same scope set
   bool insert(const Id& id, const V& val) {
-    auto it = map_.find(id.symbol());
-    if (it == map_.end()) {
-      auto emplace_res = map_.emplace(id.symbol(), std::vector<value_type>{});
-      assert(emplace_res.second);
-      it = emplace_res.first;
-    }
+    auto& bindings = map_[id.symbol()];
+
+    // after the bindings of the same size, so equal sizes keep their order
+    auto size = id.scope_set().size();
+    auto pos = std::ranges::partition_point(
+        bindings.values, [&](const value_type& binding) {
+          return binding.id.scope_set().size() >= size;
+        });
+    auto idx = pos - bindings.values.begin();
 
-    // TODO check for duplicates here, we should probably return false if there
-    // is a duplicate, and true otherwise
+    // bindings of the same size directly precede pos
+    for (auto it = pos; it != bindings.values.begin();) {
+      --it;
+      if (it->id.scope_set().size() != size) {
+        break;
+      }
+      if (it->id.scope_set() == id.scope_set()) {
+        return false;
+      }
+    }
 
-    auto& vec = it->second;
-    vec.emplace_back(binding_type{id, val});
+    ++generation_;
+    bindings.values.insert(pos, binding_type{id, val});
+    bindings.signatures.insert(bindings.signatures.begin() + idx,
+                               detail::scope_signature(id.scope_set()));
     return true;
   }
 
   // this will find all bindings for the given id, regardless of scope, this is
-  // useful for error reporting and diagnostics, but not for name resolution
+  // useful for error reporting and diagnostics, but not for name resolution.
+  // Bindings with larger scope sets come first.
   std::span<value_type> find_bindings(const Id& id) {
-    auto it = map_.find(id.symbol());
-    if (it == map_.end()) {
+    auto* bindings = detail::find_symbol(map_, id.symbol());
+    if (!bindings) {
       return {};
     }
-    return it->second;
+    return bindings->values;
   }
 
   // should always check the base of the filter_view for empty before checking
   // the filter itself
   auto find_matching_bindings(const Id& id) {
-    // TODO: this could probably be optimized by storing by ascending scope_set
-    // size
     return find_bindings(id) |
            std::views::filter([&](const value_type& binding) {
              return binding.id.scope_set().subset_of(id.scope_set());
            });
   }
 
+  // the binding with the largest scope set that is a subset of the scope set
+  // of id. Candidates are tried from the largest set down, skipping those
+  // larger than the scope set of id and those whose signature rules them out,
+  // up to the first match. Another match of the same size makes the lookup
+  // ambiguous.
   std::expected<value_type, lookup_error> lookup(const Id& id) {
-    auto matching_bindings = find_matching_bindings(id);
-
-    std::size_t largest = 0;
-    std::optional<value_type> best{};
-    for (const value_type& binding : matching_bindings) {
-      if (binding.id.scope_set().subset_of(id.scope_set()) &&
-          binding.id.scope_set().size() > largest) {
-        best = binding;
-        largest = binding.id.scope_set().size();
+    return copy(find_best(id));
+  }
+
+  // lookup(id) through a cache keyed by the symbol and ss, which has to be
+  // the interned scope set of id in the same scope_set_table for every call.
+  // Repeated lookups are a single hash probe until the next insert.
+  std::expected<value_type, lookup_error> lookup(const Id& id,
+                                                 scope_set_handle ss) {
+    auto [it, inserted] = cache_.try_emplace(cache_key{id.symbol(), ss});
+    auto& entry = it->second;
+    if (!inserted && entry.generation == generation_) {
+      ++hits_;
+    } else {
+      ++misses_;
+      entry = cached_lookup{generation_, find_best(id)};
+    }
+    return copy(entry.result);
+  }
+
+  void clear_cache() { cache_.clear(); }
+
+  // lookup(ids[i]) for every identifier occurrence in a form, written to
+  // out[i]. ss[i] has to be the interned scope set of ids[i]. Occurrences are
+  // grouped by symbol and scope set, each distinct pair is resolved once and
+  // the bindings of each symbol are found once, in order of the symbols.
+  // Returns the number of distinct pairs. Doesn't use the lookup cache.
+  std::size_t
+  resolve_all(std::span<const Id> ids, std::span<const scope_set_handle> ss,
+              std::span<std::expected<value_type, lookup_error>> out) {
+    assert(ids.size() == ss.size() && ids.size() == out.size());
+    auto& sc = scratch_;
+    auto key = [&](std::uint32_t i) {
+      return cache_key{ids[i].symbol(), ss[i]};
+    };
+
+    // group the occurrences in one pass, only the distinct pairs are sorted
+    constexpr auto empty = ~std::uint32_t{0};
+    auto mask = std::bit_ceil(2 * ids.size() + 1) - 1;
+    sc.buckets.assign(mask + 1, empty);
+    sc.firsts.clear();
+    sc.pairs.resize(ids.size());
+    for (std::uint32_t i = 0; i != ids.size(); ++i) {
+      auto k = key(i);
+      auto b = cache_key_hash{}(k) & mask;
+      while (sc.buckets[b] != empty && !(key(sc.firsts[sc.buckets[b]]) == k)) {
+        b = (b + 1) & mask;
+      }
+      if (sc.buckets[b] == empty) {
+        sc.buckets[b] = static_cast<std::uint32_t>(sc.firsts.size());
+        sc.firsts.push_back(i);
+      }
+      sc.pairs[i] = sc.buckets[b];
+    }
+
+    auto distinct = sc.firsts.size();
+    sc.order.resize(distinct);
+    for (std::uint32_t p = 0; p != distinct; ++p) {
+      sc.order[p] = p;
+    }
+    std::ranges::sort(sc.order, [&](std::uint32_t a, std::uint32_t b) {
+      const auto& sa = ids[sc.firsts[a]].symbol();
+      const auto& sb = ids[sc.firsts[b]].symbol();
+      if (detail::symbol_less(sa, sb)) {
+        return true;
+      }
+      if (detail::symbol_less(sb, sa)) {
+        return false;
+      }
+      return ss[sc.firsts[a]].id() < ss[sc.firsts[b]].id();
+    });
+
+    // the bindings of each symbol are found once
+    sc.results.resize(distinct);
+    const symbol_bindings* bindings = nullptr;
+    for (std::size_t n = 0; n != distinct; ++n) {
+      const auto& id = ids[sc.firsts[sc.order[n]]];
+      const auto& prev = ids[sc.firsts[sc.order[n == 0 ? 0 : n - 1]]];
+      if (n == 0 || !(prev.symbol() == id.symbol())) {
+        bindings = detail::find_symbol(map_, id.symbol());
       }
+      sc.results[sc.order[n]] = find_best(bindings, id.scope_set());
+    }
+
+    for (std::size_t i = 0; i != ids.size(); ++i) {
+      out[i] = copy(sc.results[sc.pairs[i]]);
     }
-    if (best) {
-      return *best;
-    } else if (matching_bindings.base().empty()) {
+    return distinct;
+  }
+
+private:
+  static std::expected<value_type, lookup_error>
+  copy(const std::expected<const value_type*, lookup_error>& res) {
+    if (res) {
+      return **res;
+    }
+    return std::unexpected(res.error());
+  }
+
+  std::expected<const value_type*, lookup_error> find_best(const Id& id) {
+    return find_best(detail::find_symbol(map_, id.symbol()), id.scope_set());
+  }
+
+  // the best of the bindings of a symbol, null if it has none, for ss
+  template <typename ScopeSet>
+  static std::expected<const value_type*, lookup_error>
+  find_best(const symbol_bindings* found, const ScopeSet& ss) {
+    if (!found || found->values.empty()) {
       return std::unexpected(lookup_error::key_not_found);
-    } else {
-      return std::unexpected(lookup_error::scope_not_found);
     }
+
+    const auto& bindings = *found;
+    auto size = ss.size();
+    auto signature = detail::scope_signature(ss);
+
+    auto first = std::ranges::partition_point(
+        bindings.values, [&](const value_type& binding) {
+          return binding.id.scope_set().size() > size;
+        });
+    auto matches = [&](std::size_t i) {
+      return (bindings.signatures[i] & ~signature) == 0 &&
+             bindings.values[i].id.scope_set().subset_of(ss);
+    };
+
+    auto count = bindings.values.size();
+    for (auto i = static_cast<std::size_t>(first - bindings.values.begin());
+         i != count; ++i) {
+      if (!matches(i)) {
+        continue;
+      }
+      auto best = bindings.values[i].id.scope_set().size();
+      for (auto j = i + 1;
+           j != count && bindings.values[j].id.scope_set().size() == best;
+           ++j) {
+        if (matches(j)) {
+          return std::unexpected(lookup_error::ambiguous);
+        }
+      }
+      return &bindings.values[i];
+    }
+    return std::unexpected(lookup_error::scope_not_found);
   }
 };
 } // namespace ely
@@ -219,10 +1109,20 @@ template <> struct fmt::formatter<ely::scope> {
   }
 };
 
-template <> struct fmt::formatter<ely::scope_set> {
+template <> struct fmt::formatter<ely::scope_set_handle> {
   constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
   template <typename Ctx>
-  constexpr auto format(const ely::scope_set& ss, Ctx& ctx) const {
+  constexpr auto format(const ely::scope_set_handle& ss, Ctx& ctx) const {
+    return fmt::format_to(ctx.out(), "scope_set_handle({})", ss.id());
+  }
+};
+
+namespace ely {
+namespace detail {
+struct scope_set_formatter {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+  template <typename ScopeSet, typename Ctx>
+  constexpr auto format(const ScopeSet& ss, Ctx& ctx) const {
     return fmt::format_to(
         ctx.out(), "scope_set({})",
         fmt::join(
@@ -231,3 +1131,12 @@ template <> struct fmt::formatter<ely::scope_set> {
             ", "));
   }
 };
+} // namespace detail
+} // namespace ely
+
+template <>
+struct fmt::formatter<ely::tree_scope_set> : ely::detail::scope_set_formatter {
+};
+
+template <>
+struct fmt::formatter<ely::scope_set> : ely::detail::scope_set_formatter {};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ely/stx/lexer2.hpp"
+#include "ely/stx/tokens.hpp"
+
+namespace ely {
+namespace stx {
+// a decoded token, the lexer emits a compact byte encoding which is awkward to
+// index into, the parser works on these instead.
+struct token {
+  token_kind kind;
+  std::uint32_t offset; // offset of the first character in the source
+  std::uint32_t width;  // number of characters of source text
+
+  constexpr std::uint32_t end() const { return offset + width; }
+
+  constexpr bool is_atmosphere() const {
+    return ely_token_is_atmosphere(kind);
+  }
+
+  friend bool operator==(const token&, const token&) = default;
+};
+
+// width in characters of tokens which don't encode their length
+constexpr std::uint32_t fixed_width(token_kind tk) {
+  switch (tk) {
+  case token_kind::newline_crlf:
+  case token_kind::true_lit:
+  case token_kind::false_lit:
+  case token_kind::syntax:
+  case token_kind::quasisyntax:
+  case token_kind::unsyntax:
+  case token_kind::unquote_splicing:
+    return 2;
+  case token_kind::unsyntax_splicing:
+    return 3;
+  case token_kind::eof:
+  case token_kind::buffer_full:
+  case token_kind::spill:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+// number of payload bytes following the kind byte in the encoded stream
+constexpr std::size_t payload_size(token_kind tk) {
+  switch (tk) {
+  case token_kind::whitespace:
+  case token_kind::tab:
+  case token_kind::unknown:
+  case token_kind::identifier:
+  case token_kind::integer_lit:
+  case token_kind::decimal_lit:
+  case token_kind::string_lit:
+  case token_kind::keyword_lit:
+  case token_kind::line_comment:
+    return 1;
+  case token_kind::block_comment:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// decodes tokens from the encoded buffer until eof or buffer_full is found,
+// offset is the source offset of the first encoded token. Returns the source
+// offset following the last decoded token.
+// spills are not handled, they have to be cut off the buffer beforehand.
+constexpr std::uint32_t decode(std::span<const std::uint8_t> encoded,
+                               std::uint32_t offset, std::vector<token>& out) {
+  const std::uint8_t* it = encoded.data();
+  const std::uint8_t* end = encoded.data() + encoded.size();
+
+  while (it != end) {
+    auto kind = static_cast<token_kind>(*it++);
+    assert(kind != token_kind::spill && "source must be '\\0' terminated");
+
+    if (kind == token_kind::buffer_full) {
+      break;
+    }
+
+    std::uint32_t width = payload_size(kind) != 0 ? *it : fixed_width(kind);
+    it += payload_size(kind);
+
+    out.push_back(token{kind, offset, width});
+    offset += width;
+
+    if (kind == token_kind::eof) {
+      break;
+    }
+  }
+
+  return offset;
+}
+
+namespace detail {
+// lex one buffer worth of tokens starting at offset, returns the source offset
+// following the decoded tokens.
+inline std::uint32_t lex_chunk(std::string_view src, std::uint32_t offset,
+                               std::span<std::uint8_t> buffer,
+                               std::vector<token>& out) {
+  auto written = lex2(src.substr(offset), buffer);
+  // a token running over the terminator, such as a comment or string cut
+  // off by it, spills. Its kind is written last, after the payload.
+  bool spilled =
+      written >= 3 &&
+      buffer[written - 1] == static_cast<std::uint8_t>(token_kind::spill);
+  if (spilled) {
+    written -= 3;
+  }
+  offset = decode(buffer.first(written), offset, out);
+  // the tokens end before the cut off one
+  if (spilled) {
+    out.push_back(token{token_kind::eof, offset, 0});
+  }
+  return offset;
+}
+} // namespace detail
+
+// lex the entire '\0' terminated source into decoded tokens, the last token is
+// always eof.
+inline std::vector<token> tokenize(std::string_view src) {
+  assert(!src.empty() && src.back() == '\0');
+
+  constexpr std::size_t buffer_size = 64 * 1024;
+  auto buffer = std::make_unique<std::uint8_t[]>(buffer_size);
+
+  std::vector<token> res;
+  // roughly one token every 4 characters
+  res.reserve(src.size() / 4);
+
+  std::uint32_t offset = 0;
+  do {
+    offset = detail::lex_chunk(src, offset, {buffer.get(), buffer_size}, res);
+  } while (res.empty() || res.back().kind != token_kind::eof);
+
+  return res;
+}
+
+// tokens of src after old_width characters at offset of the source old was
+// lexed from were replaced by new_width characters. Lexing restarts at the
+// first token which could have seen the edit and stops at the first token
+// boundary which lines up with a boundary of old behind the edit, the tokens
+// from there on are copied from old with shifted offsets. Lexing is
+// proportional to the damaged region, copying the tokens is linear.
+inline std::vector<token> retokenize(std::span<const token> old,
+                                     std::string_view src, std::uint32_t offset,
+                                     std::uint32_t old_width,
+                                     std::uint32_t new_width) {
+  assert(!src.empty() && src.back() == '\0');
+  assert(!old.empty() && old.back().kind == token_kind::eof);
+  assert(offset + old_width <= old.back().offset);
+
+  // a token ending at the edit looked at its first character to end there
+  auto first = std::ranges::lower_bound(old, offset, {}, &token::end);
+  std::vector<token> res(old.begin(), first);
+  res.reserve(old.size() + new_width / 4);
+
+  // small chunks, most edits only damage a few tokens
+  constexpr std::size_t buffer_size = 1024;
+  auto buffer = std::make_unique<std::uint8_t[]>(buffer_size);
+
+  std::uint32_t old_end = offset + old_width;
+  std::uint32_t new_end = offset + new_width;
+  auto it = first;
+  std::uint32_t pos = first->offset;
+
+  while (true) {
+    auto begin = res.size();
+    pos = detail::lex_chunk(src, pos, {buffer.get(), buffer_size}, res);
+
+    for (auto i = begin; i != res.size(); ++i) {
+      if (res[i].offset < new_end) {
+        continue;
+      }
+      // the rest of the source is the same and is lexed from the same state
+      auto old_at = res[i].offset - new_end + old_end;
+      while (it->offset < old_at && it->kind != token_kind::eof) {
+        ++it;
+      }
+      if (it->offset == old_at) {
+        res.resize(i);
+        for (; it != old.end(); ++it) {
+          res.push_back(token{it->kind, it->offset - old_end + new_end,
+                              it->width});
+        }
+        return res;
+      }
+    }
+
+    if (res.back().kind == token_kind::eof) {
+      return res;
+    }
+  }
+}
+} // namespace stx
+} // namespace ely
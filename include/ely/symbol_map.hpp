@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ely/symbol.hpp"
+
+namespace ely {
+// a map from symbols to T indexed directly by the symbol id. Interners hand
+// out ids sequentially, so the ids in use are dense and finding a symbol is
+// an index into its page and a bit test, without hashing.
+// Pages of PageSize ids are only allocated once a symbol in them is
+// inserted, so a map only holding a few symbols interned late stays small.
+// Every slot of an allocated page holds a T, default constructed while the
+// symbol isn't in the map.
+template <typename T, std::size_t PageSize = 256> class symbol_map {
+  static_assert(std::has_single_bit(PageSize),
+                "page size has to be a power of 2");
+
+public:
+  using key_type = ely::symbol;
+  using mapped_type = T;
+
+private:
+  static constexpr std::size_t page_shift = std::countr_zero(PageSize);
+  static constexpr std::size_t page_mask = PageSize - 1;
+
+  struct page {
+    std::bitset<PageSize> present;
+    std::array<T, PageSize> values{};
+  };
+
+  std::vector<std::unique_ptr<page>> pages_; // null if never used
+  std::size_t size_ = 0;
+
+public:
+  symbol_map() = default;
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // null if sym isn't in the map
+  T* find(key_type sym) {
+    return const_cast<T*>(std::as_const(*this).find(sym));
+  }
+
+  const T* find(key_type sym) const {
+    assert(sym && "invalid symbol");
+    auto p = sym.id >> page_shift;
+    if (p >= pages_.size() || !pages_[p]) {
+      return nullptr;
+    }
+    const auto& pg = *pages_[p];
+    auto i = sym.id & page_mask;
+    return pg.present[i] ? &pg.values[i] : nullptr;
+  }
+
+  bool contains(key_type sym) const { return find(sym) != nullptr; }
+
+  // the value of sym, constructed from args if sym wasn't in the map yet
+  template <typename... Args>
+  std::pair<T*, bool> try_emplace(key_type sym, Args&&... args) {
+    auto& pg = page_of(sym);
+    auto i = sym.id & page_mask;
+    if (pg.present[i]) {
+      return {&pg.values[i], false};
+    }
+    pg.present.set(i);
+    ++size_;
+    if constexpr (sizeof...(Args) != 0) {
+      pg.values[i] = T(static_cast<Args&&>(args)...);
+    }
+    return {&pg.values[i], true};
+  }
+
+  T& operator[](key_type sym) { return *try_emplace(sym).first; }
+
+  // true if sym was in the map
+  bool erase(key_type sym) {
+    auto p = sym.id >> page_shift;
+    if (p >= pages_.size() || !pages_[p]) {
+      return false;
+    }
+    auto& pg = *pages_[p];
+    auto i = sym.id & page_mask;
+    if (!pg.present[i]) {
+      return false;
+    }
+    pg.present.reset(i);
+    pg.values[i] = T{};
+    --size_;
+    return true;
+  }
+
+  void clear() {
+    pages_.clear();
+    size_ = 0;
+  }
+
+  // calls f(symbol, value) for every symbol in the map, in order of ids
+  template <typename F> void for_each(F f) { for_each(*this, f); }
+  template <typename F> void for_each(F f) const { for_each(*this, f); }
+
+private:
+  page& page_of(key_type sym) {
+    assert(sym && "invalid symbol");
+    auto p = sym.id >> page_shift;
+    if (p >= pages_.size()) {
+      pages_.resize(p + 1);
+    }
+    if (!pages_[p]) {
+      pages_[p] = std::make_unique<page>();
+    }
+    return *pages_[p];
+  }
+
+  template <typename Self, typename F> static void for_each(Self& self, F& f) {
+    for (std::size_t p = 0; p != self.pages_.size(); ++p) {
+      if (!self.pages_[p]) {
+        continue;
+      }
+      auto& pg = *self.pages_[p];
+      for (std::size_t i = 0; i != PageSize; ++i) {
+        if (pg.present[i]) {
+          f(key_type{static_cast<key_type::id_type>((p << page_shift) | i)},
+            pg.values[i]);
+        }
+      }
+    }
+  }
+};
+} // namespace ely
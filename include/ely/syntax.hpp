@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "ely/green/list.hpp"
+#include "ely/green/token.hpp"
+#include "ely/scope.hpp"
+
+namespace ely {
+// a green node or a list built by the expander, with a scope set.
+// Scope operations are applied to the node itself right away, but only
+// recorded for its children and pushed down to a child when it is inspected,
+// composed with the child's own pending operations. Rescoping a tree costs
+// the same regardless of its size, subtrees which are never looked at are
+// never rescoped.
+// Every descendant of a green node has the scope set of the node, so green
+// children just inherit it. Only built lists, which may combine syntax with
+// different scopes, keep pending operations.
+// Scope sets and operations are interned in a scope_set_table, which has to
+// be the same for every operation on a tree.
+class syntax {
+private:
+  using green_node = green::list::value_type;
+
+  green_node green_{}; // empty for built lists
+  const syntax* children_ = nullptr;
+  std::uint32_t size_ = 0;
+  scope_set_handle ss_;
+  scope_ops pending_; // not yet applied to children_
+
+  constexpr syntax(green_node green, scope_set_handle ss)
+      : green_(green), ss_(ss) {}
+
+public:
+  syntax() = default;
+
+  static constexpr syntax wrap(const green_node& node,
+                               scope_set_handle ss = {}) {
+    return syntax(node, ss);
+  }
+
+  static constexpr syntax wrap(const green::list& l, scope_set_handle ss = {}) {
+    return syntax(green_node(std::addressof(l)), ss);
+  }
+
+  static constexpr syntax wrap(const green::token& t,
+                               scope_set_handle ss = {}) {
+    return syntax(green_node(std::addressof(t)), ss);
+  }
+
+  // a list of children with their own scopes, copied into arena
+  template <typename Arena>
+  static syntax make_list(Arena& arena, std::span<const syntax> children,
+                          scope_set_handle ss = {}) {
+    auto* copy = arena.template allocate<syntax>(children.size());
+    std::uninitialized_copy(children.begin(), children.end(), copy);
+    syntax res;
+    res.children_ = copy;
+    res.size_ = static_cast<std::uint32_t>(children.size());
+    res.ss_ = ss;
+    return res;
+  }
+
+  constexpr bool is_green() const { return green_ != green_node{}; }
+  constexpr bool is_list() const { return !is_green() || green_.as_list(); }
+
+  // the green node, empty for built lists
+  constexpr green_node green() const { return green_; }
+  constexpr const green::token* as_token() const {
+    return is_green() ? green_.as_token() : nullptr;
+  }
+
+  constexpr scope_set_handle scope_set() const { return ss_; }
+
+  // operations not yet pushed down to the children
+  constexpr const scope_ops& pending() const { return pending_; }
+
+  // number of children, 0 for tokens
+  constexpr std::size_t size() const {
+    if (!is_green()) {
+      return size_;
+    }
+    const auto* l = green_.as_list();
+    return l ? l->size() : 0;
+  }
+
+  // the i-th child with every pending operation applied
+  syntax child(scope_set_table& table, std::size_t i) const {
+    assert(i < size());
+    if (is_green()) {
+      return syntax((*green_.as_list())[i], ss_);
+    }
+    return children_[i].apply(table, pending_);
+  }
+
+  [[nodiscard]]
+  syntax apply(scope_set_table& table, const scope_ops& ops) const {
+    if (ops.empty()) {
+      return *this;
+    }
+    auto res = *this;
+    res.ss_ = table.apply(ss_, ops);
+    if (!is_green()) {
+      res.pending_ = table.compose(pending_, ops);
+    }
+    return res;
+  }
+
+  [[nodiscard]]
+  syntax add_scope(scope_set_table& table, scope sc) const {
+    return apply(table, table.adding(sc));
+  }
+
+  [[nodiscard]]
+  syntax remove_scope(scope_set_table& table, scope sc) const {
+    return apply(table, table.removing(sc));
+  }
+
+  [[nodiscard]]
+  syntax flip_scope(scope_set_table& table, scope sc) const {
+    return apply(table, table.flipping(sc));
+  }
+};
+} // namespace ely
@@ -59,6 +59,22 @@ constexpr const auto&& get_unchecked(const ely::variant<Ts...>&& v) noexcept {
   return std::move(v).get_unchecked(std::in_place_type<T>);
 }
 
+namespace detail {
+template <typename... Ts> void is_ely_variant(const ely::variant<Ts...>&);
+}
+
+// variant-like types providing their own unchecked access, such as tagged
+// pointers
+template <std::size_t I, typename V>
+  requires(!requires(const V& v) { detail::is_ely_variant(v); } &&
+           requires(V&& v) {
+             static_cast<V&&>(v).get_unchecked(std::in_place_index<I>);
+           })
+constexpr decltype(auto) get_unchecked(V&& v) noexcept {
+  assert(v.index() == I);
+  return static_cast<V&&>(v).get_unchecked(std::in_place_index<I>);
+}
+
 template <std::size_t I, typename... Ts>
   requires(I < sizeof...(Ts))
 constexpr auto& get_unchecked(std::variant<Ts...>& v) noexcept {
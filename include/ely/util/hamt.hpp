@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+namespace ely {
+namespace detail {
+// spreads the bits of a hash, std::hash of integers is usually the identity
+constexpr std::uint64_t mix_hash(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  return h;
+}
+} // namespace detail
+
+// a persistent hash map as a hash array mapped trie. Inserting returns a new
+// map which shares every node not on the path to the key with the old one, so
+// copying a map is an O(1) snapshot and a sequence of snapshots only takes
+// memory proportional to the changes between them.
+// Nodes are immutable and allocated in an arena, which has to outlive every
+// map using them, keys and values are never destroyed.
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename Eq = std::equal_to<K>>
+class hamt {
+  static_assert(std::is_trivially_destructible_v<K> &&
+                    std::is_trivially_destructible_v<V>,
+                "hamt nodes are released with their arena");
+
+public:
+  struct entry {
+    std::uint64_t hash;
+    K key;
+    V value;
+  };
+
+private:
+  static constexpr unsigned bits = 5;
+  static constexpr unsigned hash_bits = 64;
+
+  // every 5 bit chunk of the hash selects either an entry or a child. Nodes
+  // below the last full chunk only hold entries with equal hashes, counted in
+  // datamap.
+  struct node {
+    std::uint32_t datamap = 0;
+    std::uint32_t nodemap = 0;
+    const entry* entries = nullptr;
+    const node* const* children = nullptr;
+  };
+
+  const node* root_ = nullptr;
+  std::size_t size_ = 0;
+
+public:
+  hamt() = default;
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // null if key isn't in the map
+  const V* find(const K& key) const {
+    auto h = hash(key);
+    const node* n = root_;
+    for (unsigned shift = 0; n; shift += bits) {
+      if (shift >= hash_bits) {
+        for (const auto& e : collisions(*n)) {
+          if (Eq{}(e.key, key)) {
+            return &e.value;
+          }
+        }
+        return nullptr;
+      }
+
+      auto bit = chunk_bit(h, shift);
+      if (n->datamap & bit) {
+        const auto& e = n->entries[index(n->datamap, bit)];
+        return e.hash == h && Eq{}(e.key, key) ? &e.value : nullptr;
+      }
+      n = (n->nodemap & bit) ? n->children[index(n->nodemap, bit)] : nullptr;
+    }
+    return nullptr;
+  }
+
+  bool contains(const K& key) const { return find(key) != nullptr; }
+
+  // a map with key set to value, copying the nodes on the path to it
+  template <typename Arena>
+  [[nodiscard]] hamt insert(Arena& arena, const K& key, const V& value) const {
+    auto e = entry{hash(key), key, value};
+    bool added = false;
+    hamt res;
+    res.root_ = root_ ? set(arena, *root_, 0, e, added)
+                      : make(arena, chunk_bit(e.hash, 0), 0, &e, nullptr);
+    res.size_ = size_ + (root_ ? added : 1);
+    return res;
+  }
+
+  // calls f(key, value) for every entry, in no particular order
+  template <typename F> void for_each(F f) const {
+    if (root_) {
+      for_each(*root_, 0, f);
+    }
+  }
+
+  // both maps share their root, not just equal contents
+  bool is_same(const hamt& other) const { return root_ == other.root_; }
+
+private:
+  static std::uint64_t hash(const K& key) {
+    return detail::mix_hash(static_cast<std::uint64_t>(Hash{}(key)));
+  }
+
+  static std::uint32_t chunk_bit(std::uint64_t h, unsigned shift) {
+    return std::uint32_t{1} << ((h >> shift) & ((1u << bits) - 1));
+  }
+
+  static std::size_t index(std::uint32_t map, std::uint32_t bit) {
+    return static_cast<std::size_t>(std::popcount(map & (bit - 1)));
+  }
+
+  static std::span<const entry> collisions(const node& n) {
+    return {n.entries, n.datamap};
+  }
+
+  template <typename Arena>
+  static const node* make(Arena& arena, std::uint32_t datamap,
+                          std::uint32_t nodemap, const entry* entries,
+                          const node* const* children) {
+    auto* n = arena.template allocate<node>();
+    n->datamap = datamap;
+    n->nodemap = nodemap;
+    auto entry_count = static_cast<std::size_t>(std::popcount(datamap));
+    auto child_count = static_cast<std::size_t>(std::popcount(nodemap));
+    auto* es = arena.template allocate<entry>(entry_count);
+    std::uninitialized_copy_n(entries, entry_count, es);
+    auto* cs = arena.template allocate<const node*>(child_count);
+    std::uninitialized_copy_n(children, child_count, cs);
+    n->entries = es;
+    n->children = cs;
+    return n;
+  }
+
+  template <typename Arena>
+  static const node* make_collision(Arena& arena, const entry* entries,
+                                    std::size_t count) {
+    auto* n = arena.template allocate<node>();
+    n->datamap = static_cast<std::uint32_t>(count);
+    n->nodemap = 0;
+    auto* es = arena.template allocate<entry>(count);
+    std::uninitialized_copy_n(entries, count, es);
+    n->entries = es;
+    n->children = nullptr;
+    return n;
+  }
+
+  // a node holding two entries whose hashes agree below shift
+  template <typename Arena>
+  static const node* merge(Arena& arena, const entry& a, const entry& b,
+                           unsigned shift) {
+    if (shift >= hash_bits) {
+      entry both[] = {a, b};
+      return make_collision(arena, both, 2);
+    }
+    auto bit_a = chunk_bit(a.hash, shift);
+    auto bit_b = chunk_bit(b.hash, shift);
+    if (bit_a == bit_b) {
+      const node* child = merge(arena, a, b, shift + bits);
+      return make(arena, 0, bit_a, nullptr, &child);
+    }
+    entry both[] = {a, b};
+    if (bit_b < bit_a) {
+      std::swap(both[0], both[1]);
+    }
+    return make(arena, bit_a | bit_b, 0, both, nullptr);
+  }
+
+  // n with e set, added is set if e's key wasn't in n yet
+  template <typename Arena>
+  static const node* set(Arena& arena, const node& n, unsigned shift,
+                         const entry& e, bool& added) {
+    if (shift >= hash_bits) {
+      auto old = collisions(n);
+      auto* es = arena.template allocate<entry>(old.size() + 1);
+      std::uninitialized_copy(old.begin(), old.end(), es);
+      auto it = std::find_if(es, es + old.size(), [&](const entry& x) {
+        return Eq{}(x.key, e.key);
+      });
+      added = it == es + old.size();
+      std::construct_at(it, e);
+      auto* res = arena.template allocate<node>();
+      *res = node{static_cast<std::uint32_t>(old.size() + added), 0, es,
+                  nullptr};
+      return res;
+    }
+
+    auto bit = chunk_bit(e.hash, shift);
+    auto entry_count = static_cast<std::size_t>(std::popcount(n.datamap));
+    auto child_count = static_cast<std::size_t>(std::popcount(n.nodemap));
+
+    if (n.datamap & bit) {
+      auto idx = index(n.datamap, bit);
+      const auto& old = n.entries[idx];
+      if (old.hash == e.hash && Eq{}(old.key, e.key)) {
+        // same shape, only the entry changes
+        auto* es = arena.template allocate<entry>(entry_count);
+        std::uninitialized_copy_n(n.entries, entry_count, es);
+        es[idx] = e;
+        auto* res = arena.template allocate<node>();
+        *res = node{n.datamap, n.nodemap, es, n.children};
+        return res;
+      }
+
+      // the entry moves down into a new child along with e
+      added = true;
+      const node* child = merge(arena, old, e, shift + bits);
+      auto* res = arena.template allocate<node>();
+      auto* es = arena.template allocate<entry>(entry_count - 1);
+      std::uninitialized_copy_n(n.entries, idx, es);
+      std::uninitialized_copy(n.entries + idx + 1, n.entries + entry_count,
+                              es + idx);
+      auto cidx = index(n.nodemap, bit);
+      auto* cs = arena.template allocate<const node*>(child_count + 1);
+      std::uninitialized_copy_n(n.children, cidx, cs);
+      cs[cidx] = child;
+      std::uninitialized_copy(n.children + cidx, n.children + child_count,
+                              cs + cidx + 1);
+      *res = node{n.datamap & ~bit, n.nodemap | bit, es, cs};
+      return res;
+    }
+
+    if (n.nodemap & bit) {
+      auto cidx = index(n.nodemap, bit);
+      const node* child = set(arena, *n.children[cidx], shift + bits, e, added);
+      auto* cs = arena.template allocate<const node*>(child_count);
+      std::uninitialized_copy_n(n.children, child_count, cs);
+      cs[cidx] = child;
+      auto* res = arena.template allocate<node>();
+      *res = node{n.datamap, n.nodemap, n.entries, cs};
+      return res;
+    }
+
+    added = true;
+    auto idx = index(n.datamap, bit);
+    auto* es = arena.template allocate<entry>(entry_count + 1);
+    std::uninitialized_copy_n(n.entries, idx, es);
+    std::construct_at(es + idx, e);
+    std::uninitialized_copy(n.entries + idx, n.entries + entry_count,
+                            es + idx + 1);
+    auto* res = arena.template allocate<node>();
+    *res = node{n.datamap | bit, n.nodemap, es, n.children};
+    return res;
+  }
+
+  template <typename F>
+  static void for_each(const node& n, unsigned shift, F& f) {
+    if (shift >= hash_bits) {
+      for (const auto& e : collisions(n)) {
+        f(e.key, e.value);
+      }
+      return;
+    }
+    auto entry_count = static_cast<std::size_t>(std::popcount(n.datamap));
+    for (std::size_t i = 0; i != entry_count; ++i) {
+      f(n.entries[i].key, n.entries[i].value);
+    }
+    auto child_count = static_cast<std::size_t>(std::popcount(n.nodemap));
+    for (std::size_t i = 0; i != child_count; ++i) {
+      for_each(*n.children[i], shift + bits, f);
+    }
+  }
+};
+} // namespace ely
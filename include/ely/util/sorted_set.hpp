@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+#include "ely/config.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// set operations on sorted arrays of unique 32 bit keys, such as scope ids.
+// Elements are compared by their bit pattern as an unsigned integer, which
+// has to match their order.
+// Membership of blocks of elements is tested with SIMD compares of every pair
+// of lanes where available, output is produced by branchless merges.
+namespace ely {
+namespace sorted_set {
+template <typename T>
+concept key32 = sizeof(T) == 4 && std::is_trivially_copyable_v<T>;
+
+namespace detail {
+template <key32 T> constexpr std::uint32_t key(const T& x) {
+  return std::bit_cast<std::uint32_t>(x);
+}
+
+#if defined(__AVX2__)
+inline constexpr std::size_t lanes = 8;
+
+// bit i is set if lane i of a is equal to any lane of b
+ELY_ALWAYS_INLINE unsigned block_matches(const void* a, const void* b) {
+  auto va = _mm256_loadu_si256(static_cast<const __m256i*>(a));
+  auto vb = _mm256_loadu_si256(static_cast<const __m256i*>(b));
+  auto rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  auto eq = _mm256_cmpeq_epi32(va, vb);
+  for (int r = 1; r != 8; ++r) {
+    vb = _mm256_permutevar8x32_epi32(vb, rotate);
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+  }
+  return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+}
+#elif defined(__SSE2__)
+inline constexpr std::size_t lanes = 4;
+
+// bit i is set if lane i of a is equal to any lane of b
+ELY_ALWAYS_INLINE unsigned block_matches(const void* a, const void* b) {
+  auto va = _mm_loadu_si128(static_cast<const __m128i*>(a));
+  auto vb = _mm_loadu_si128(static_cast<const __m128i*>(b));
+  // b rotated by 1, 2 and 3 lanes
+  auto b1 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+  auto b2 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2));
+  auto b3 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3));
+  auto eq0 = _mm_cmpeq_epi32(va, vb);
+  auto eq1 = _mm_cmpeq_epi32(va, b1);
+  auto eq2 = _mm_cmpeq_epi32(va, b2);
+  auto eq3 = _mm_cmpeq_epi32(va, b3);
+  auto eq = _mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3));
+  return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+}
+#else
+inline constexpr std::size_t lanes = 0;
+#endif
+
+inline constexpr unsigned full_mask = (1u << lanes) - 1;
+
+// where matching a against b stopped: the blocks of a before i are done, the
+// elements of a's current block found in b before j are set in mask
+struct block_state {
+  std::size_t i = 0;
+  std::size_t j = 0;
+  unsigned mask = 0;
+  bool stopped = false;
+};
+
+// compares a and b a block at a time while both have a full block left,
+// advancing the block with the smaller last element, or both. Every pair of
+// equal elements is in exactly one pair of compared blocks. done(i, mask) is
+// called once a's block starting at i has been compared to every block of b
+// it could match and may return false to stop.
+template <key32 T, typename Done>
+constexpr block_state match_blocks(std::span<const T> a, std::span<const T> b,
+                                   Done done) {
+  block_state s;
+#if defined(__AVX2__) || defined(__SSE2__)
+  if !consteval {
+    while (s.i + lanes <= a.size() && s.j + lanes <= b.size()) {
+      s.mask |= block_matches(a.data() + s.i, b.data() + s.j);
+      auto a_last = key(a[s.i + lanes - 1]);
+      auto b_last = key(b[s.j + lanes - 1]);
+      if (a_last <= b_last) {
+        if (!done(s.i, s.mask)) {
+          s.stopped = true;
+          return s;
+        }
+        s.i += lanes;
+        s.mask = 0;
+      }
+      if (b_last <= a_last) {
+        s.j += lanes;
+      }
+    }
+  }
+#endif
+  return s;
+}
+
+// the rest of a after match_blocks, calls each(k, found) for every element a[k]
+// in order and stops once it returns false
+template <key32 T, typename Each>
+constexpr bool match_rest(std::span<const T> a, std::span<const T> b,
+                          block_state s, Each each) {
+  auto j = s.j;
+  for (auto k = s.i; k != a.size(); ++k) {
+    auto x = key(a[k]);
+    while (j != b.size() && key(b[j]) < x) {
+      ++j;
+    }
+    bool found = (j != b.size() && key(b[j]) == x) ||
+                 (k - s.i < lanes && ((s.mask >> (k - s.i)) & 1));
+    if (!each(k, found)) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace detail
+
+// whether every element of sub is in super
+template <key32 T>
+constexpr bool includes(std::span<const T> super, std::span<const T> sub) {
+  if (sub.size() > super.size()) {
+    return false;
+  }
+  if (sub.empty()) {
+    return true;
+  }
+  // sub can't be covered by a range of super that doesn't cover its ends
+  if (detail::key(sub.front()) < detail::key(super.front()) ||
+      detail::key(super.back()) < detail::key(sub.back())) {
+    return false;
+  }
+  auto s = detail::match_blocks(sub, super, [](std::size_t, unsigned mask) {
+    return mask == detail::full_mask;
+  });
+  return !s.stopped && detail::match_rest(sub, super, s,
+                                          [](std::size_t, bool found) {
+                                            return found;
+                                          });
+}
+
+// number of elements in both a and b
+template <key32 T>
+constexpr std::size_t intersection_size(std::span<const T> a,
+                                        std::span<const T> b) {
+  std::size_t res = 0;
+  auto s = detail::match_blocks(a, b, [&](std::size_t, unsigned mask) {
+    res += static_cast<std::size_t>(std::popcount(mask));
+    return true;
+  });
+  detail::match_rest(a, b, s, [&](std::size_t, bool found) {
+    res += found;
+    return true;
+  });
+  return res;
+}
+
+// elements in both a and b, out must have room for a.size() elements.
+// Returns the end of the output.
+template <key32 T>
+constexpr T* set_intersection(std::span<const T> a, std::span<const T> b,
+                              T* out) {
+  auto s = detail::match_blocks(a, b, [&](std::size_t i, unsigned mask) {
+    for (auto found = mask; found != 0; found &= found - 1) {
+      *out++ = a[i + static_cast<std::size_t>(std::countr_zero(found))];
+    }
+    return true;
+  });
+  detail::match_rest(a, b, s, [&](std::size_t k, bool found) {
+    *out = a[k];
+    out += found;
+    return true;
+  });
+  return out;
+}
+
+// elements of a which aren't in b, out must have room for a.size() elements.
+// Returns the end of the output.
+template <key32 T>
+constexpr T* set_difference(std::span<const T> a, std::span<const T> b,
+                            T* out) {
+  auto s = detail::match_blocks(a, b, [&](std::size_t i, unsigned mask) {
+    for (auto missing = ~mask & detail::full_mask; missing != 0;
+         missing &= missing - 1) {
+      *out++ = a[i + static_cast<std::size_t>(std::countr_zero(missing))];
+    }
+    return true;
+  });
+  detail::match_rest(a, b, s, [&](std::size_t k, bool found) {
+    *out = a[k];
+    out += !found;
+    return true;
+  });
+  return out;
+}
+
+// out must have room for a.size() + b.size() elements. Returns the end of the
+// output.
+template <key32 T>
+constexpr T* set_union(std::span<const T> a, std::span<const T> b, T* out) {
+  std::size_t i = 0, j = 0;
+  while (i != a.size() && j != b.size()) {
+    auto x = detail::key(a[i]);
+    auto y = detail::key(b[j]);
+    *out++ = x <= y ? a[i] : b[j];
+    i += x <= y;
+    j += y <= x;
+  }
+  out = std::copy(a.begin() + i, a.end(), out);
+  return std::copy(b.begin() + j, b.end(), out);
+}
+
+// elements in exactly one of a and b, out must have room for a.size() +
+// b.size() elements. Returns the end of the output.
+template <key32 T>
+constexpr T* set_symmetric_difference(std::span<const T> a,
+                                      std::span<const T> b, T* out) {
+  std::size_t i = 0, j = 0;
+  while (i != a.size() && j != b.size()) {
+    auto x = detail::key(a[i]);
+    auto y = detail::key(b[j]);
+    *out = x < y ? a[i] : b[j];
+    out += x != y;
+    i += x <= y;
+    j += y <= x;
+  }
+  out = std::copy(a.begin() + i, a.end(), out);
+  return std::copy(b.begin() + j, b.end(), out);
+}
+} // namespace sorted_set
+} // namespace ely
@@ -7,7 +7,10 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <span>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <fmt/compile.h>
@@ -15,12 +18,18 @@
 
 #include "ely/arena/block.hpp"
 #include "ely/arena/dumb_typed.hpp"
+#include "ely/arena/growing.hpp"
 #include "ely/expander.hpp"
+#include "ely/green/flat.hpp"
+#include "ely/green/form_stream.hpp"
+#include "ely/green/parallel.hpp"
+#include "ely/green/printer.hpp"
 #include "ely/interner.hpp"
 #include "ely/lexer.hpp"
 #include "ely/parser.hpp"
 #include "ely/stream.hpp"
 #include "ely/stx.hpp"
+#include "ely/stx/token.hpp"
 
 std::FILE* open_output_file(const char* outfile) {
   if (std::strcmp("-", outfile) == 0) {
@@ -82,6 +91,21 @@ in_out_files parse_in_out(std::span<char*> args) {
   return {out, std::move(input_streams)};
 }
 
+// read the entire file, '\0' terminated as required by the lexer
+std::string read_file(std::FILE* in) {
+  std::string res;
+  constexpr auto buffer_size = 64 * 1024;
+  char buffer[buffer_size];
+
+  for (auto read = std::fread(buffer, 1, buffer_size, in); read != 0;
+       read = std::fread(buffer, 1, buffer_size, in)) {
+    res.append(buffer, read);
+  }
+
+  res.push_back('\0');
+  return res;
+}
+
 int execute_lex(std::span<char*> args);
 int execute_parse(std::span<char*> args);
 int execute_expand(std::span<char*> args);
@@ -143,36 +167,57 @@ int execute_lex(std::span<char*> args) {
 }
 
 int execute_parse(std::span<char*> args) {
-  auto in_out = parse_in_out(args);
+  // --flat writes the serialized tree instead of text, for tools reading the
+  // tree directly. --pretty breaks up and indents nested lists.
+  std::vector<char*> rest;
+  bool flat = false;
+  auto options = ely::green::print_options{};
+  for (char* arg : args) {
+    if (std::strcmp("--flat", arg) == 0) {
+      flat = true;
+    } else if (std::strcmp("--pretty", arg) == 0) {
+      options.layout = ely::green::print_layout::indented;
+    } else {
+      rest.push_back(arg);
+    }
+  }
+
+  auto in_out = parse_in_out(rest);
   if (!in_out.out_file)
     return EXIT_FAILURE;
 
   std::FILE* out = in_out.out_file;
+  auto printer = ely::green::printer(fileno(out), options);
 
-  constexpr auto buffer_size = 64 * 1024;
-  char buffer[buffer_size];
-  constexpr auto token_buffer_size = 64;
-  ely::token token_buffer[token_buffer_size];
-  for (std::FILE* in : in_out.input_files) {
-    ely::file_stream stream(in, buffer, buffer_size);
-    auto intern_arena = ely::arena::fixed_block<char, 128 * 1024>{};
-    auto interner = ely::simple_interner{intern_arena};
+  auto num_threads = std::max(std::thread::hardware_concurrency(), 1u);
 
-    // reuse intern arena as the general string arena, they should share
-    // lifetimes so it's fine
-    auto lex = ely::lexer{std::move(stream), intern_arena, interner,
-                          token_buffer, token_buffer_size};
-
-    auto stx_arena = ely::arena::fixed_block<ely::stx::sexp, 1024>{};
-    auto parser = ely::parser(lex, stx_arena, interner);
-
-    for (ely::stx::sexp* node = parser.next(); node && !node->is_eof();
-         node = parser.next()) {
-      fmt::print(out, "{}\n", *node);
+  for (std::FILE* in : in_out.input_files) {
+    auto interner = ely::simple_interner{};
+
+    if (!flat) {
+      // forms are printed as they are parsed, only one is kept in memory
+      auto arena = ely::arena::growing{};
+      auto forms = ely::green::form_stream(in, interner, arena);
+      for (auto form = forms.next(); form; form = forms.next()) {
+        printer.print(*form, interner);
+      }
+      continue;
     }
+
+    // the flat tree needs the whole file, parse top level forms on all cores
+    auto src = read_file(in);
+    auto tokens = ely::stx::tokenize(src);
+    auto arenas = std::vector<ely::arena::growing>(num_threads);
+    auto root = ely::green::parse_file_parallel(src, tokens, interner,
+                                                std::span(arenas));
+    auto bytes = ely::green::serialize(root, interner);
+    std::fwrite(bytes.data(), 1, bytes.size(), out);
   }
 
-  std::fprintf(out, "parse end\n");
+  if (!flat) {
+    printer.flush();
+    std::fprintf(out, "parse end\n");
+  }
   return EXIT_SUCCESS;
 }
 
@@ -42,7 +42,41 @@ template <typename Arena> constexpr bool test_arena() {
   return true;
 }
 
+template <typename Arena> constexpr bool test_release() {
+  Arena arena;
+  auto* first = arena.template allocate<int>();
+  *first = 1;
+
+  auto mark = arena.mark();
+  auto* p1 = arena.template allocate<char>(8);
+  // force new blocks
+  for (int i = 0; i != 16; ++i) {
+    arena.template allocate<char>(8192);
+  }
+  arena.release(mark);
+
+  // released memory is handed out again, earlier allocations stay intact
+  auto* p2 = arena.template allocate<char>(8);
+  if (!std::is_constant_evaluated()) {
+    assert(p1 == p2);
+  }
+  assert(*first == 1);
+
+  {
+    auto r = ely::arena::region(arena);
+    arena.template allocate<char>(1 << 16);
+  }
+  auto* p3 = arena.template allocate<char>(8);
+  if (!std::is_constant_evaluated()) {
+    assert(p3 == p2 + 8);
+  }
+
+  return true;
+}
+
 void arena() {
+  assert(test_release<ely::arena::slab<4096>>());
+  assert(test_release<ely::arena::growing>());
   assert(test_arena<ely::arena::slab<4096>>());
   assert(test_arena<ely::arena::growing>());
   static_assert(test_arena<ely::arena::constexpr_>());
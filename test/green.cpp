@@ -1,5 +1,25 @@
+#include <ely/arena/growing.hpp>
+#include <ely/green/diff.hpp>
+#include <ely/green/events.hpp>
+#include <ely/green/flat.hpp>
+#include <ely/green/form_stream.hpp>
+#include <ely/green/lazy.hpp>
 #include <ely/green/list.hpp>
+#include <ely/green/parallel.hpp>
+#include <ely/green/parser.hpp>
+#include <ely/green/printer.hpp>
 #include <ely/green/token.hpp>
+#include <ely/interner.hpp>
+#include <ely/io/mapped_file.hpp>
+#include <ely/origin.hpp>
+#include <ely/stx/token.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_set>
 
 #include "util.hpp"
 
@@ -8,20 +28,705 @@ using namespace ely::green;
 constexpr int parser() {
   auto i = int_literal(0);
   auto s = string_literal("hello world");
-  auto id = identifier("app");
+  auto interner = ely::simple_interner{};
+  auto app = interner.intern("app");
+  auto id = identifier(app, interner.lookup(app));
 
-  auto lb = list_builder{};
+  auto arena = ely::arena::growing{};
+  auto lb = list_builder(arena);
   lb.emplace_back(i);
   lb.emplace_back(std::move(s));
 
   auto lb2 = lb;
   auto l = lb.finish();
 
-  check_eq("(0 \"hello world\")", fmt::to_string(l));
+  check_eq("(0 \"hello world\")", fmt::to_string(named(l, interner)));
 
   lb2.emplace_back(id);
   l = lb2.finish();
+  check_eq("(0 \"hello world\" app)", fmt::to_string(named(l, interner)));
+  // identifiers keep their names, the interner isn't needed to print them
   check_eq("(0 \"hello world\" app)", fmt::to_string(l));
+  check_eq("symbol(0)", fmt::to_string(id.sym()));
+
+  return 0;
+}
+
+int reparse() {
+  auto src = std::string("(define (f x) (+ x 1))\n(g 2)");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto old = ely::green::parser(src, tokens, interner, arena).parse_file();
+  check_eq("((define (f x) (+ x 1)) (g 2))",
+           fmt::to_string(named(old, interner)));
+  check_eq(src.size() - 1, old.width());
+
+  // replace `1` with `42`
+  auto edit = ely::green::text_edit{src.find('1'), 1, 2};
+  auto new_src = src;
+  new_src.replace(edit.offset, edit.old_width, "42");
+  auto new_tokens = ely::stx::retokenize(tokens, new_src, edit.offset,
+                                         edit.old_width, edit.new_width);
+  assert(new_tokens == ely::stx::tokenize(new_src));
+  auto res = ely::green::parser(new_src, new_tokens, interner, arena)
+                 .reparse(old, edit);
+  check_eq("((define (f x) (+ x 42)) (g 2))",
+           fmt::to_string(named(res, interner)));
+  check_eq(new_src.size() - 1, res.width());
+
+  // untouched lists are shared with the old tree
+  assert(res[1].as_list()->is_same(*old[1].as_list()));
+  const auto& define = *res[0].as_list();
+  assert(define[1].as_list()->is_same(*(*old[0].as_list())[1].as_list()));
+  assert(!define[2].as_list()->is_same(*(*old[0].as_list())[2].as_list()));
+
+  // removing a delimiter falls back to a full parse
+  edit = ely::green::text_edit{new_src.find(')'), 1, 0};
+  auto unbalanced = new_src;
+  unbalanced.erase(edit.offset, edit.old_width);
+  new_tokens = ely::stx::retokenize(new_tokens, unbalanced, edit.offset,
+                                    edit.old_width, edit.new_width);
+  assert(new_tokens == ely::stx::tokenize(unbalanced));
+  res = ely::green::parser(unbalanced, new_tokens, interner, arena)
+            .reparse(res, edit);
+  auto full =
+      ely::green::parser(unbalanced, new_tokens, interner, arena).parse_file();
+  check_eq(fmt::to_string(named(full, interner)),
+           fmt::to_string(named(res, interner)));
+
+  return 0;
+}
+
+int retokenize() {
+  auto src = std::string("(a \"b\" ; c\n  #t 12 #,@d)\r\n(e)");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+
+  struct edit {
+    std::size_t offset;
+    std::size_t old_width;
+    std::string_view text;
+  };
+  // joining and splitting tokens, opening a string, a comment and a crlf
+  const edit edits[] = {{1, 2, ""},    {2, 0, "x"},   {3, 0, "\""},
+                        {9, 0, ";"},   {10, 0, "\r"}, {11, 1, ""},
+                        {16, 1, ""},   {25, 1, ""},   {24, 0, "\n"},
+                        {0, 0, "(("},  {29, 0, "f"},  {0, 29, ""}};
+
+  for (const auto& e : edits) {
+    auto edited = src;
+    edited.replace(e.offset, e.old_width, e.text);
+    auto res = ely::stx::retokenize(tokens, edited, e.offset, e.old_width,
+                                    e.text.size());
+    assert(res == ely::stx::tokenize(edited));
+  }
+
+  // a long tail behind the edit is copied
+  auto tail = src;
+  tail.pop_back();
+  for (int i = 0; i != 1000; ++i) {
+    tail += " (g h)";
+  }
+  tail.push_back('\0');
+  tokens = ely::stx::tokenize(tail);
+  auto edited = tail;
+  edited.insert(2, "bc");
+  assert(ely::stx::retokenize(tokens, edited, 2, 0, 2) ==
+         ely::stx::tokenize(edited));
+
+  return 0;
+}
+
+int parallel() {
+  std::string src;
+  for (int i = 0; i != 64; ++i) {
+    src += fmt::format("; form {}\n(define x{} (a [b {{c}}] \"d\"))\n", i, i);
+  }
+  // stray closers and trailing atmosphere
+  src += ") e  ";
+  src.push_back('\0');
+
+  auto tokens = ely::stx::tokenize(src);
+  auto forms = ely::green::top_level_forms(tokens);
+  check_eq(std::size_t{66}, forms.size());
+
+  auto interner = ely::simple_interner{};
+  ely::arena::growing arenas[4];
+  auto seq = ely::green::parser(src, tokens, interner, arenas[0]).parse_file();
+  auto par = ely::green::parse_file_parallel(
+      src, tokens, interner, std::span<ely::arena::growing>(arenas));
+  check_eq(seq.size(), par.size());
+  check_eq(seq.width(), par.width());
+  check_eq(fmt::to_string(named(seq, interner)),
+           fmt::to_string(named(par, interner)));
+
+  return 0;
+}
+
+int zero_copy() {
+  auto src = std::string("(f \"plain\" \"esc\\\\aped\" f)");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto l = ely::green::parser(src, tokens, interner, arena).parse_file();
+  const auto& form = *l[0].as_list();
+
+  const auto& f0 = form[0].get_unchecked(std::in_place_type<token>);
+  const auto& f1 = form[3].get_unchecked(std::in_place_type<token>);
+  const auto& id0 = f0.get_unchecked(std::in_place_type<identifier>);
+  const auto& id1 = f1.get_unchecked(std::in_place_type<identifier>);
+  // both occurrences share the interned name
+  assert(id0.sym() == id1.sym());
+  check_eq(std::string_view("f"), interner.lookup(id0.sym()));
+
+  const auto& plain = form[1]
+                          .get_unchecked(std::in_place_type<token>)
+                          .get_unchecked(std::in_place_type<string_literal>);
+  const auto& escaped = form[2]
+                            .get_unchecked(std::in_place_type<token>)
+                            .get_unchecked(std::in_place_type<string_literal>);
+  // literals without escapes point into the source
+  assert(plain.value().data() == src.data() + src.find("plain"));
+  check_eq(std::string_view("esc\\aped"), escaped.value());
+
+  return 0;
+}
+
+int flat() {
+  auto src = std::string("; c\n(define (f x) (+ x 1.5 \"s\"))\n(f [g] x)  ");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto l = ely::green::parser(src, tokens, interner, arena).parse_file();
+
+  auto bytes = ely::green::serialize(l, interner);
+  auto tree = ely::green::flat_tree::open(bytes);
+  assert(tree.has_value());
+  auto root = (*tree).root();
+  check_eq(fmt::to_string(named(l, interner)), fmt::to_string(root));
+  check_eq(l.width(), root.width());
+  check_eq(l.size(), root.size());
+  check_eq((*tree).size(), root.extent());
+  // f and x are only stored once
+  check_eq(std::size_t{6}, (*tree).string_count());
+
+  // the last child directly precedes its list
+  auto last = *root.rbegin();
+  check_eq(l[1].width(), last.width());
+  check_eq(l[1].as_list()->open_width(), last.open_width());
+
+  // read it back from a memory mapping
+  char path[] = "/tmp/ely_flat_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  auto* file = fdopen(fd, "wb");
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::fclose(file);
+  {
+    auto mapped = ely::io::mapped_file(path);
+    assert(mapped);
+    auto mapped_tree = ely::green::flat_tree::open(mapped.bytes());
+    assert(mapped_tree.has_value());
+    check_eq(fmt::to_string(named(l, interner)),
+             fmt::to_string((*mapped_tree).root()));
+  }
+  std::remove(path);
+
+  bytes[0] = std::byte{0};
+  assert(!ely::green::flat_tree::open(bytes).has_value());
+  bytes[0] = std::byte{0x45};
+  assert(ely::green::flat_tree::open(bytes).has_value());
+
+  // truncated and corrupt buffers are rejected instead of read out of bounds
+  auto truncated = std::span<const std::byte>(bytes).first(bytes.size() - 1);
+  assert(!ely::green::flat_tree::open(truncated).has_value());
+
+  auto header = ely::green::flat_header{};
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  auto layout = ely::green::detail::flat_layout(header);
+  auto corrupt = [&](std::size_t offset, std::uint32_t value) {
+    auto copy = bytes;
+    std::memcpy(copy.data() + offset, &value, sizeof(value));
+    return !ely::green::flat_tree::open(copy).has_value();
+  };
+  auto last_node = 4 * (header.node_count - 1);
+  assert(corrupt(layout.extents + last_node, header.node_count + 1));
+  assert(corrupt(layout.extents + last_node - 4, header.node_count));
+  assert(corrupt(layout.data, header.value_count + header.string_count));
+  assert(corrupt(layout.string_offsets + 4, header.string_bytes + 1));
+
+  return 0;
+}
+
+int stream() {
+  auto src = std::string("; header comment\n(a b)\n");
+  // a form larger than the chunk size
+  src += "(define (long-function-name argument) (body argument \"str\"))\n";
+  for (int i = 0; i != 32; ++i) {
+    src += fmt::format("(f{} {})  ; trailing\n", i, i);
+  }
+  src += "last";
+
+  auto* file = std::tmpfile();
+  std::fwrite(src.data(), 1, src.size(), file);
+  std::rewind(file);
+
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto forms = ely::green::form_stream(file, interner, arena, 16);
+
+  auto terminated = src + '\0';
+  auto tokens = ely::stx::tokenize(terminated);
+  auto full_arena = ely::arena::growing{};
+  auto full =
+      ely::green::parser(terminated, tokens, interner, full_arena).parse_file();
+
+  std::size_t i = 0;
+  for (auto form = forms.next(); form; form = forms.next(), ++i) {
+    assert(i < full.size());
+    check_eq(fmt::to_string(named(full[i], interner)),
+             fmt::to_string(named(*form, interner)));
+    check_eq(full[i].width(), (*form).width());
+  }
+  check_eq(full.size(), i);
+  std::fclose(file);
+
+  return 0;
+}
+
+int events() {
+  auto src =
+      std::string("; c\n(define (f x) [+ x 1 \"s\"])\n) {g}\n(h (i)");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto full = ely::green::parser(src, tokens, interner, arena).parse_file();
+
+  auto events = ely::green::parse_events(tokens);
+  auto green = ely::green::green_sink(src, tokens, interner, arena);
+  auto flat = ely::green::flat_sink(src, tokens, arena);
+  auto print = ely::green::print_sink(src, tokens);
+  auto count = ely::green::count_sink{};
+  ely::green::replay(events, green, flat, print, count);
+
+  check_eq(fmt::to_string(named(full, interner)),
+           fmt::to_string(named(green.root(), interner)));
+  check_eq(full.width(), green.root().width());
+  check_eq(full[0].as_list()->open_width(),
+           green.root()[0].as_list()->open_width());
+
+  auto bytes = ely::green::serialize(full, interner);
+  assert(std::ranges::equal(bytes, flat.bytes()));
+
+  check_eq(fmt::to_string(named(full, interner)), print.str());
+
+  // root, define, (f x), [+ ...], {g}, (h (i)), (i)
+  check_eq(std::size_t{7}, count.lists);
+  // the stray ) is a token of the root
+  check_eq(std::size_t{11}, count.tokens);
+  check_eq(std::size_t{3}, count.max_depth);
+
+  // nesting far deeper than the call stack could take
+  constexpr std::size_t depth = 300000;
+  auto deep = std::string(depth, '(') + "#'x" + std::string(depth, ')');
+  deep.push_back('\0');
+  auto deep_tokens = ely::stx::tokenize(deep);
+  auto deep_count = ely::green::count_sink{};
+  ely::green::replay(ely::green::parse_events(deep_tokens), deep_count);
+  check_eq(depth + 2, deep_count.max_depth);
+  auto deep_root =
+      ely::green::parser(deep, deep_tokens, interner, arena).parse_file();
+  check_eq(deep.size() - 1, deep_root.width());
+
+  return 0;
+}
+
+int lazy() {
+  auto src = std::string("(define (f x) (let [(y {x})] (g y)))\n"
+                         "(define z 1) ) (unterminated (a");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+
+  // unterminated lists match eof
+  auto brackets = ely::green::match_brackets(tokens);
+  auto unterminated = std::ranges::find(tokens, std::uint32_t(src.find("(unt")),
+                                        &ely::stx::token::offset);
+  check_eq(std::uint32_t(tokens.size() - 1),
+           brackets.match[unterminated - tokens.begin()]);
+  check_eq(std::uint32_t(src.find("))\n") + 1),
+           tokens[brackets.match[0]].offset);
+
+  auto p = ely::green::lazy_parser(src, tokens, interner, arena);
+  auto root = p.parse_file();
+  check_eq(std::size_t{4}, root.size());
+  check_eq(src.size() - 1, root.width());
+
+  const auto& define = *root[0].as_list();
+  assert(define.is_lazy());
+  // only the signature is parsed
+  const auto& signature = *define[1].as_list();
+  assert(!define.is_lazy());
+  check_eq(std::string_view("f"),
+           fmt::to_string(named(signature[0], interner)));
+  assert(define[2].as_list()->is_lazy());
+
+  auto eager = ely::green::parser(src, tokens, interner, arena).parse_file();
+  check_eq(fmt::to_string(named(eager, interner)),
+           fmt::to_string(named(root, interner)));
+  check_eq(eager[0].width(), root[0].width());
+  check_eq(eager[3].as_list()->open_width(), root[3].as_list()->open_width());
+  check_eq(eager[3].width(), root[3].width());
+
+  return 0;
+}
+
+int prefix_closer() {
+  // a closing delimiter directly after a prefix closes the enclosing list,
+  // at the top level it is a stray token. '(a ') with the prefix the lexer
+  // knows
+  auto src = std::string("#'(a #') #' ) x");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+
+  auto eager = ely::green::parser(src, tokens, interner, arena).parse_file();
+  auto p = ely::green::lazy_parser(src, tokens, interner, arena);
+  auto lazy = p.parse_file();
+  auto green = ely::green::green_sink(src, tokens, interner, arena);
+  ely::green::replay(ely::green::parse_events(tokens), green);
+
+  check_eq(std::string_view("((syntax (a (syntax))) (syntax) ) x)"),
+           fmt::to_string(named(eager, interner)));
+  check_eq(fmt::to_string(named(eager, interner)),
+           fmt::to_string(named(lazy, interner)));
+  check_eq(fmt::to_string(named(eager, interner)),
+           fmt::to_string(named(green.root(), interner)));
+
+  check_eq(eager.size(), lazy.size());
+  for (std::size_t i = 0; i != eager.size(); ++i) {
+    check_eq(eager[i].width(), lazy[i].width());
+  }
+  const auto& quoted = *eager[0].as_list();
+  check_eq(quoted[1].width(), (*lazy[0].as_list())[1].width());
+
+  auto forms = ely::green::top_level_forms(tokens);
+  check_eq(eager.size(), forms.size());
+
+  return 0;
+}
+
+int brackets() {
+  // more than one block of tokens, with every kind of imbalance
+  auto src = std::string(") (a [b {c}] (d e]) ") + std::string(40, ' ') +
+             "(f (g {h} (i)";
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto table = ely::green::match_brackets(tokens);
+
+  auto index = [&](std::string_view s) {
+    auto it = std::ranges::find(tokens, std::uint32_t(src.find(s)),
+                                &ely::stx::token::offset);
+    return static_cast<std::uint32_t>(it - tokens.begin());
+  };
+
+  check_eq(std::vector<std::uint32_t>{index(") (")}, table.stray);
+  check_eq(std::vector<std::uint32_t>{index("]) ")}, table.mismatched);
+  check_eq((std::vector<std::uint32_t>{index("(f"), index("(g")}),
+           table.unclosed);
+  assert(!table.balanced());
+
+  check_eq(index("}]"), table.match[index("{c")]);
+  check_eq(index("{c"), table.match[index("}]")]);
+  check_eq(ely::green::bracket_table::no_match, table.match[index(") (")]);
+  check_eq(std::uint32_t(tokens.size() - 1), table.match[index("(f")]);
+
+  check_eq(std::uint32_t{0}, table.depth[index(") (")]);
+  check_eq(std::uint32_t{0}, table.depth[index("(a")]);
+  check_eq(std::uint32_t{1}, table.depth[index("a [")]);
+  check_eq(std::uint32_t{2}, table.depth[index("{c")]);
+  check_eq(std::uint32_t{3}, table.depth[index("c}")]);
+  check_eq(std::uint32_t{2}, table.depth[index("}]")]);
+  check_eq(std::uint32_t{1}, table.depth[index("]) ")]);
+  check_eq(std::uint32_t{3}, table.depth[index("h}")]);
+
+  // the scalar depth count agrees on every token
+  std::uint32_t depth = 0;
+  for (std::size_t i = 0; i != tokens.size(); ++i) {
+    auto delta = ely::green::detail::depth_delta(tokens[i].kind);
+    if (delta < 0 && depth != 0) {
+      --depth;
+    }
+    check_eq(depth, table.depth[i]);
+    if (delta > 0) {
+      ++depth;
+    }
+  }
+
+  auto balanced = std::string("(a [b] {c})");
+  balanced.push_back('\0');
+  assert(ely::green::match_brackets(ely::stx::tokenize(balanced)).balanced());
+
+  return 0;
+}
+
+int origins() {
+  auto a = std::string("(a)");
+  auto src = std::string("(f x)\n  [g 1.5 \"s\"]");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+
+  auto sources = ely::source_map{};
+  auto a_start = sources.add_file("a.ely", a);
+  auto start = sources.add_file("b.ely", std::string_view(src).substr(0, 19));
+  auto loc = sources.locate(a_start + 3);
+  check_eq(0u, loc.file);
+  check_eq(3u, loc.offset);
+  loc = sources.locate(start);
+  check_eq(1u, loc.file);
+  check_eq(0u, loc.offset);
+
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto root =
+      ely::green::parser(src, tokens, interner, arena, 0, start).parse_file();
+  check_eq(start, root.origin());
+  check_eq(start, root[0].origin());
+  check_eq(start + 3, (*root[0].as_list())[1].origin());
+
+  const auto& vec = *root[1].as_list();
+  check_eq(std::string_view("b.ely:2:3"),
+           fmt::to_string(sources.resolve(vec.origin())));
+  check_eq(std::string_view("b.ely:2:10"),
+           fmt::to_string(sources.resolve(vec[2].origin())));
+  check_eq(std::string_view("b.ely:2:14"),
+           fmt::to_string(sources.resolve(root.origin() + root.width())));
+
+  // every parser assigns the same origins
+  auto p = ely::green::lazy_parser(src, tokens, interner, arena, start);
+  auto lazy = p.parse_file();
+  check_eq(vec.origin(), lazy[1].origin());
+  check_eq(vec[1].origin(), (*lazy[1].as_list())[1].origin());
+
+  auto green = ely::green::green_sink(src, tokens, interner, arena, start);
+  ely::green::replay(ely::green::parse_events(tokens), green);
+  check_eq(root.origin(), green.root().origin());
+  check_eq(vec[2].origin(), (*green.root()[1].as_list())[2].origin());
+
+  // without a base there is no origin
+  auto plain = ely::green::parser(src, tokens, interner, arena).parse_file();
+  assert(!plain[1].origin());
+
+  return 0;
+}
+
+int walk() {
+  auto src = std::string("(a (b c) [d]) e");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto root = ely::green::parser(src, tokens, interner, arena).parse_file();
+
+  auto trace = [&](bool skip_inner) {
+    std::string res;
+    for (auto& c : ely::green::cursor(root)) {
+      constexpr char steps[] = {'e', 't', 'l'};
+      res += fmt::format("{}{}:{} ", steps[static_cast<int>(c.step())],
+                         c.offset(), c.depth());
+      if (skip_inner && c.step() == cursor_step::enter && c.depth() == 2) {
+        c.skip();
+      }
+    }
+    return res;
+  };
+  check_eq(std::string("e0:0 e0:1 t1:2 e2:2 t4:3 t5:3 l2:2 e8:2 t10:3 l8:2 "
+                       "l0:1 t13:1 l0:0 "),
+           trace(false));
+  check_eq(std::string("e0:0 e0:1 t1:2 e2:2 l2:2 e8:2 l8:2 l0:1 t13:1 l0:0 "),
+           trace(true));
+
+  // nested far deeper than recursion would allow
+  constexpr std::size_t depth = 100000;
+  auto deep = ely::green::list();
+  for (std::size_t i = 0; i != depth; ++i) {
+    auto builder = list_builder(arena);
+    builder.open(1);
+    if (i != 0) {
+      builder.emplace_back(deep);
+    }
+    builder.close(1);
+    deep = builder.finish();
+  }
+  auto str = fmt::to_string(deep);
+  check_eq(std::string(depth, '(') + std::string(depth, ')'), str);
+
+  return 0;
+}
+
+int printing() {
+  auto src = std::string("(define (f x) (g [x 1.5] \"s\")) 42 (h)");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto root = ely::green::parser(src, tokens, interner, arena).parse_file();
+
+  auto print = [&](print_layout layout) {
+    std::FILE* file = std::tmpfile();
+    {
+      // flush in the middle of forms as well
+      auto p = printer(fileno(file), {.layout = layout, .flush_size = 8});
+      for (const auto& form : root) {
+        p.print(form, interner);
+      }
+      p.flush();
+      assert(p.ok());
+    }
+
+    std::string res(static_cast<std::size_t>(std::ftell(file)), '\0');
+    std::rewind(file);
+    std::fread(res.data(), 1, res.size(), file);
+    std::fclose(file);
+    return res;
+  };
+
+  std::string expected;
+  for (const auto& form : root) {
+    expected += fmt::format("{}\n", named(form, interner));
+  }
+  check_eq(expected, print(print_layout::compact));
+  check_eq(std::string("(define\n"
+                       "  (f x)\n"
+                       "  (g\n"
+                       "    (x 1.5)\n"
+                       "    \"s\"))\n"
+                       "42\n"
+                       "(h)\n"),
+           print(print_layout::indented));
+
+  return 0;
+}
+
+int structure() {
+  // tokens are hashed on construction, which has to stay constexpr
+  using ely::green::identifier;
+  using ely::green::int_literal;
+  using ely::green::string_literal;
+  static_assert(int_literal(1).hash() == int_literal(1, 3, {}).hash());
+  static_assert(int_literal(1).hash() != int_literal(2).hash());
+  static_assert(string_literal("s").hash() != string_literal("t").hash());
+  static_assert(identifier(ely::symbol(1), "x").hash() !=
+                int_literal(1).hash());
+
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto parse = [&](std::string& src) {
+    src.push_back('\0');
+    auto tokens = ely::stx::tokenize(src);
+    return ely::green::parser(src, tokens, interner, arena).parse_file();
+  };
+
+  auto a = std::string("(f (g 1) \"s\" 2.5) (h)");
+  auto spaced = std::string("  (f\n  (g   1) \"s\"  2.5)\n(h) ; comment");
+  auto changed = std::string("(f (g 2) \"s\" 2.5) (h)");
+  auto root = parse(a);
+  auto same = parse(spaced);
+  auto other = parse(changed);
+
+  // widths and origins don't matter
+  check_eq(root.hash(), same.hash());
+  assert(structurally_equal(root, same));
+  assert(root.width() != same.width());
+  assert(!structurally_equal(root, other));
+  assert(structurally_equal(root[1], other[1]));
+  assert(!structurally_equal(root[0], root[1]));
+
+  // tokens of different kinds with the same value
+  assert(!structurally_equal(token(int_literal(1)),
+                             token(float_literal(1.0f))));
+  assert(structurally_equal(token(int_literal(1, 3)), token(int_literal(1))));
+
+  // lazy lists hash their children once parsed
+  auto tokens = ely::stx::tokenize(a);
+  auto p = ely::green::lazy_parser(a, tokens, interner, arena);
+  auto lazy = p.parse_file();
+  assert(lazy[0].as_list()->is_lazy());
+  check_eq(root[0].hash(), lazy[0].hash());
+  assert(structurally_equal(root, lazy));
+
+  auto forms = std::unordered_set<list::value_type, structural_hash,
+                                  structural_equal>{};
+  for (const auto* r : {&root, &same, &other}) {
+    forms.insert(r->begin(), r->end());
+  }
+  // (f (g 1) ...), (f (g 2) ...) and (h)
+  check_eq(std::size_t{3}, forms.size());
+
+  return 0;
+}
+
+int diffs() {
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto parse = [&](std::string& src) {
+    src.push_back('\0');
+    auto tokens = ely::stx::tokenize(src);
+    return ely::green::parser(src, tokens, interner, arena).parse_file();
+  };
+
+  auto a = std::string("(a 1) (b (c 2) d) (e)");
+  auto b = std::string("(a 1)\n(b (c 3) d) (x) (e)");
+  auto before = parse(a);
+  auto after = parse(b);
+
+  check_eq(std::size_t{0}, diff(before, before).size());
+
+  auto edits = diff(before, after);
+  check_eq(std::size_t{2}, edits.size());
+  // the new form is found before descending into (b ...)
+  assert(edits[0].kind == edit_kind::insert);
+  assert(edits[0].old_parent == &before && edits[0].new_parent == &after);
+  check_eq(std::size_t{2}, edits[0].old_index);
+  check_eq(std::size_t{2}, edits[0].new_index);
+  check_eq(std::string("(x)"),
+           fmt::to_string(named(*edits[0].new_node, interner)));
+  // only the changed token of (c 2)
+  assert(edits[1].kind == edit_kind::replace);
+  check_eq(std::size_t{1}, edits[1].old_index);
+  check_eq(std::string("2"),
+           fmt::to_string(named(*edits[1].old_node, interner)));
+  check_eq(std::string("3"),
+           fmt::to_string(named(*edits[1].new_node, interner)));
+  check_eq(std::string("(c 2)"),
+           fmt::to_string(named(*edits[1].old_parent, interner)));
+
+  // which top level forms changed
+  edits = diff(before, after, {.recurse = false});
+  check_eq(std::size_t{2}, edits.size());
+  assert(edits[0].kind == edit_kind::replace);
+  check_eq(std::size_t{1}, edits[0].old_index);
+  assert(edits[1].kind == edit_kind::insert);
+
+  // removal from the middle of a long list
+  auto many = std::string();
+  for (int i = 0; i != 100; ++i) {
+    many += fmt::format("(f {}) ", i);
+  }
+  auto fewer = many;
+  fewer.erase(fewer.find("(f 50)"), 7);
+  edits = diff(parse(many), parse(fewer));
+  check_eq(std::size_t{1}, edits.size());
+  assert(edits[0].kind == edit_kind::remove);
+  check_eq(std::size_t{50}, edits[0].old_index);
+  check_eq(std::size_t{50}, edits[0].new_index);
 
   return 0;
 }
@@ -30,6 +735,10 @@ constexpr int parser() {
 int main() {
   // unfortunately fmt is not all constexpr
   // static_assert(parser() == 0);
-  return parser();
+  return ::parser() + reparse() + retokenize() + parallel() + zero_copy() +
+         flat() + stream() + events() + lazy() + prefix_closer() +
+         brackets() + origins() + walk() +
+         printing() + structure() +
+         diffs();
 }
 #endif
\ No newline at end of file
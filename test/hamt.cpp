@@ -0,0 +1,71 @@
+#include <ely/arena/growing.hpp>
+#include <ely/util/hamt.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "util.hpp"
+
+// few distinct hashes, so most keys end up in collision nodes
+struct clumped_hash {
+  std::size_t operator()(int x) const {
+    return static_cast<std::size_t>(x % 3);
+  }
+};
+
+template <typename Hash> void snapshots() {
+  auto arena = ely::arena::growing{};
+  using map_type = ely::hamt<int, int, Hash>;
+  using ref_type = std::unordered_map<int, int>;
+  auto map = map_type{};
+  auto ref = ref_type{};
+  std::vector<std::pair<map_type, ref_type>> snaps;
+
+  for (int i = 0; i != 2000; ++i) {
+    // every third insert overwrites an existing key
+    int key = (i * 7919) % 1500;
+    map = map.insert(arena, key, i);
+    ref[key] = i;
+    if (i % 100 == 0) {
+      snaps.emplace_back(map, ref);
+    }
+  }
+  snaps.emplace_back(map, ref);
+
+  // later inserts don't change earlier snapshots
+  for (const auto& [snap, expected] : snaps) {
+    assert(snap.size() == expected.size());
+    for (auto [key, value] : expected) {
+      assert(snap.contains(key));
+      assert(*snap.find(key) == value);
+    }
+    assert(!snap.contains(-1));
+    std::size_t visited = 0;
+    snap.for_each([&](int key, int value) {
+      assert(expected.at(key) == value);
+      ++visited;
+    });
+    assert(visited == expected.size());
+  }
+
+  auto copy = map;
+  assert(copy.is_same(map));
+  assert(!copy.insert(arena, 1, 1).is_same(map));
+}
+
+void hamt() {
+  snapshots<std::hash<int>>();
+  fmt::println("ely/hamt/snapshots - SUCCESS");
+  snapshots<clumped_hash>();
+  fmt::println("ely/hamt/collisions - SUCCESS");
+}
+
+#ifndef NO_MAIN
+int main() {
+  hamt();
+  fmt::println("ely/hamt - SUCCESS");
+  return 0;
+}
+#endif
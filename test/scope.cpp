@@ -1,12 +1,21 @@
+#include <ely/arena/growing.hpp>
+#include <ely/binding_env.hpp>
+#include <ely/concurrent_binding_map.hpp>
 #include <ely/scope.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <expected>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "util.hpp"
 
-struct identifier {
+template <typename SS> struct identifier {
   std::string_view name;
-  ely::scope_set ss;
+  SS ss;
 
   // we can use the name as symbol for testing
   auto symbol() const { return name; }
@@ -14,6 +23,16 @@ struct identifier {
   const auto& scope_set() const { return ss; }
 };
 
+// symbols from an interner, which binding_map indexes without hashing
+struct interned_identifier {
+  ely::symbol sym;
+  ely::scope_set ss;
+
+  auto symbol() const { return sym; }
+
+  const auto& scope_set() const { return ss; }
+};
+
 template <typename SS> constexpr void test_scope() {
   auto gen = ely::scope_generator();
   auto s = gen();
@@ -42,6 +61,7 @@ template <typename SS> constexpr void test_scope() {
   assert(a.subset_of(c));
   assert(a.subset_of(d));
 
+  using identifier = ::identifier<SS>;
   auto bm = ely::binding_map<identifier, int>{};
   assert(bm.lookup(identifier{"a", a}).error() ==
          ely::lookup_error::key_not_found);
@@ -53,11 +73,444 @@ template <typename SS> constexpr void test_scope() {
   assert(bm.insert(identifier{"a", c}, 1));
   assert(bm.lookup(identifier{"a", a}).value().value() == 0);
   assert(bm.lookup(identifier{"a", c}).value().value() == 1);
+
+  // two matching bindings of the same size
+  auto sx = gen();
+  auto sy = gen();
+  auto x = SS().add_scope(sx);
+  auto y = SS().add_scope(sy);
+  auto xy = x.add_scope(sy);
+  assert(bm.insert(identifier{"b", x}, 2));
+  assert(bm.insert(identifier{"b", y}, 3));
+  assert(bm.lookup(identifier{"b", x}).value().value() == 2);
+  assert(bm.lookup(identifier{"b", xy}).error() ==
+         ely::lookup_error::ambiguous);
+  assert(bm.insert(identifier{"b", xy}, 4));
+  assert(bm.lookup(identifier{"b", xy}).value().value() == 4);
+  assert(bm.lookup(identifier{"b", a}).error() ==
+         ely::lookup_error::scope_not_found);
+  // largest scope sets first
+  assert(bm.find_bindings(identifier{"b", a}).front().value() == 4);
+
+  // rebinding the same scope set keeps the first binding
+  auto generation = bm.generation();
+  assert(!bm.insert(identifier{"b", y}, 5));
+  assert(bm.generation() == generation);
+  assert(bm.lookup(identifier{"b", y}).value().value() == 3);
+  assert(bm.find_bindings(identifier{"b", a}).size() == 3);
+}
+
+void interned_symbols() {
+  auto gen = ely::scope_generator();
+  auto outer = ely::scope_set().add_scope(gen());
+  auto inner = outer.add_scope(gen());
+  auto x = ely::symbol{0};
+  auto y = ely::symbol{1000};
+
+  auto bm = ely::binding_map<interned_identifier, int>{};
+  assert(bm.lookup(interned_identifier{x, outer}).error() ==
+         ely::lookup_error::key_not_found);
+  assert(bm.insert(interned_identifier{x, outer}, 0));
+  assert(bm.insert(interned_identifier{y, inner}, 1));
+  assert(bm.insert(interned_identifier{x, inner}, 2));
+  assert(bm.lookup(interned_identifier{x, outer}).value().value() == 0);
+  assert(bm.lookup(interned_identifier{x, inner}).value().value() == 2);
+  assert(bm.lookup(interned_identifier{y, inner}).value().value() == 1);
+  assert(bm.lookup(interned_identifier{y, outer}).error() ==
+         ely::lookup_error::scope_not_found);
+  assert(bm.lookup(interned_identifier{ely::symbol{1}, inner}).error() ==
+         ely::lookup_error::key_not_found);
+  assert(bm.find_bindings(interned_identifier{x, outer}).size() == 2);
+
+  auto table = ely::scope_set_table();
+  auto ids = std::vector<interned_identifier>{
+      {y, inner}, {x, inner}, {x, outer}, {y, inner}, {x, inner}};
+  auto handles = std::vector<ely::scope_set_handle>{
+      table.make(inner.scopes()), table.make(inner.scopes()),
+      table.make(outer.scopes()), table.make(inner.scopes()),
+      table.make(inner.scopes())};
+  auto out = std::vector<
+      std::expected<ely::binding<interned_identifier, int>, ely::lookup_error>>(
+      ids.size(), std::unexpected(ely::lookup_error::key_not_found));
+  assert(bm.resolve_all(ids, handles, out) == 3);
+  assert(out[0]->value() == 1 && out[3]->value() == 1);
+  assert(out[1]->value() == 2 && out[4]->value() == 2);
+  assert(out[2]->value() == 0);
+}
+
+// more scopes than fit inline
+void scope_set_spill() {
+  auto gen = ely::scope_generator();
+  std::vector<ely::scope> scopes;
+  for (int i = 0; i != 10; ++i) {
+    scopes.push_back(gen());
+  }
+
+  auto ss = ely::scope_set();
+  auto ts = ely::tree_scope_set();
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    ss = ss.add_scope(*it);
+    ts = ts.add_scope(*it);
+  }
+  assert(ss.size() == 10);
+  assert(std::ranges::equal(ss, ts));
+
+  auto copy = ss;
+  auto smaller = ss.remove_scope(scopes[3]);
+  assert(copy == ss);
+  assert(smaller.size() == 9);
+  assert(smaller.subset_of(ss));
+  assert(!ss.subset_of(smaller));
+  assert(!smaller.has_scope(scopes[3]));
+  assert(smaller.flip_scope(scopes[3]) == ss);
+  assert(ss.flip_scopes(scopes).size() == 0);
+
+  // merges which fit inline, and spilled ones shrinking back inline
+  auto few = std::vector<ely::scope>{scopes[2], scopes[0], scopes[2]};
+  assert(ely::scope_set().add_scopes(few) ==
+         ely::scope_set({scopes[0], scopes[2]}));
+  assert(ss.flip_scopes(few).size() == 9);
+  auto rest = std::vector<ely::scope>(scopes.begin() + 1, scopes.end());
+  assert(ss.remove_scopes(rest) == ely::scope_set({scopes[0]}));
+
+  auto moved = std::move(copy);
+  assert(moved == ss);
+  assert(copy.size() == 0);
+  for (const auto& sc : scopes) {
+    assert(moved.has_scope(sc));
+    assert(!moved.remove_scope(sc).has_scope(sc));
+  }
+
+  // inline sets move their scopes, spilled ones their heap
+  auto inline_set = ely::scope_set({scopes[1], scopes[4]});
+  moved = std::move(inline_set);
+  assert(moved == ely::scope_set({scopes[4], scopes[1]}));
+  assert(inline_set.size() == 0);
+  inline_set = std::move(moved);
+  assert(inline_set.has_scope(scopes[4]) && !inline_set.has_scope(scopes[2]));
+}
+
+// enough elements for several blocks of every vector width
+void sorted_sets() {
+  std::vector<std::uint32_t> evens, threes;
+  for (std::uint32_t i = 0; i != 40; ++i) {
+    evens.push_back(2 * i);
+    threes.push_back(3 * i);
+  }
+  std::vector<std::uint32_t> sixes;
+  std::ranges::set_intersection(evens, threes, std::back_inserter(sixes));
+
+  std::span<const std::uint32_t> a = evens, b = threes, c = sixes;
+  assert(ely::sorted_set::includes(a, c));
+  assert(ely::sorted_set::includes(b, c));
+  assert(!ely::sorted_set::includes(a, b));
+  assert(!ely::sorted_set::includes(c, a));
+  assert(ely::sorted_set::includes(a, a.subspan(3, 20)));
+  assert(ely::sorted_set::includes(a, {}));
+  assert(ely::sorted_set::intersection_size(a, b) == sixes.size());
+  assert(ely::sorted_set::intersection_size(b, c) == sixes.size());
+
+  auto check = [&](auto kernel, auto expected) {
+    std::vector<std::uint32_t> got(a.size() + b.size()), want;
+    got.resize(static_cast<std::size_t>(kernel(a, b, got.data()) -
+                                        got.data()));
+    expected(evens, threes, std::back_inserter(want));
+    assert(got == want);
+  };
+  check(ely::sorted_set::set_union<std::uint32_t>, std::ranges::set_union);
+  check(ely::sorted_set::set_difference<std::uint32_t>,
+        std::ranges::set_difference);
+  check(ely::sorted_set::set_symmetric_difference<std::uint32_t>,
+        std::ranges::set_symmetric_difference);
+}
+
+void scope_table() {
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+  auto s2 = gen();
+
+  auto empty = ely::scope_set_handle();
+  auto a = table.add_scope(empty, s1);
+  auto ab = table.add_scope(a, s0);
+  // equal sets are the same handle, regardless of how they were built
+  assert(ab == table.add_scope(table.add_scope(empty, s0), s1));
+  assert(ab == table.make({s1, s0, s1}));
+  assert(table.remove_scope(ab, s0) == a);
+  assert(table.remove_scope(a, s1) == empty);
+  assert(table.add_scope(ab, s1) == ab);
+  assert(table.remove_scope(ab, s2) == ab);
+
+  assert(table.size(ab) == 2);
+  assert(table.ids(ab)[0] == s0.id());
+  assert(table.ids(ab)[1] == s1.id());
+  assert(table.has_scope(ab, s0));
+  assert(!table.has_scope(a, s0));
+
+  assert(table.flip_scope(ab, s0) == a);
+  assert(table.flip_scope(a, s0) == ab);
+
+  assert(table.subset_of(empty, a));
+  assert(table.subset_of(a, ab));
+  assert(!table.subset_of(ab, a));
+  assert(!table.subset_of(table.make({s2}), ab));
+
+  // memoized operations don't create new sets
+  auto sets = table.size();
+  for (int i = 0; i != 10; ++i) {
+    assert(table.flip_scope(table.flip_scope(ab, s2), s2) == ab);
+  }
+  assert(table.size() == sets + 1);
+
+  auto abc = table.make({s0, s1, s2});
+  std::vector<ely::scope> bc{s2, s1, s2};
+  assert(table.add_scopes(a, bc) == table.make({s1, s2}));
+  assert(table.remove_scopes(abc, bc) == table.make({s0}));
+  // flipping a scope twice leaves it alone
+  assert(table.flip_scopes(ab, bc) == table.make({s0}));
+  assert(table.intersection_size(ab, abc) == 2);
+  assert(table.intersection_size(a, table.make({s0, s2})) == 0);
+}
+
+void cached_lookup() {
+  using identifier = ::identifier<ely::scope_set>;
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+
+  auto outer = ely::scope_set{s0};
+  auto inner = ely::scope_set{s0, s1};
+  auto outer_h = table.make({s0});
+  auto inner_h = table.make({s0, s1});
+
+  auto bm = ely::binding_map<identifier, int>{};
+  assert(bm.insert(identifier{"define", outer}, 0));
+  for (int i = 0; i != 10; ++i) {
+    assert(bm.lookup(identifier{"define", inner}, inner_h).value().value() ==
+           0);
+  }
+  assert(bm.cache_misses() == 1);
+  assert(bm.cache_hits() == 9);
+  assert(bm.lookup(identifier{"lambda", inner}, inner_h).error() ==
+         ely::lookup_error::key_not_found);
+
+  // inserting invalidates what was cached before
+  assert(bm.insert(identifier{"define", inner}, 1));
+  assert(bm.lookup(identifier{"define", inner}, inner_h).value().value() == 1);
+  assert(bm.lookup(identifier{"define", outer}, outer_h).value().value() == 0);
+  assert(bm.lookup(identifier{"define", inner}, inner_h).value().value() == 1);
+  assert(bm.cache_misses() == 4);
+  assert(bm.cache_hits() == 10);
+}
+
+// a let body referring to a few names many times
+void resolve_form() {
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+  auto outer = ely::scope_set().add_scope(s0);
+  auto inner = outer.add_scope(s1);
+  auto outer_handle = table.make({s0});
+  auto inner_handle = table.make({s0, s1});
+
+  using identifier = ::identifier<ely::scope_set>;
+  auto bm = ely::binding_map<identifier, int>{};
+  bm.insert(identifier{"x", outer}, 0);
+  bm.insert(identifier{"x", inner}, 1);
+  bm.insert(identifier{"f", outer}, 2);
+
+  std::vector<identifier> ids;
+  std::vector<ely::scope_set_handle> handles;
+  for (int i = 0; i != 20; ++i) {
+    bool in_body = i % 2 == 0;
+    auto ss = in_body ? inner : outer;
+    auto handle = in_body ? inner_handle : outer_handle;
+    for (std::string_view name : {"x", "f", "y"}) {
+      ids.push_back(identifier{name, ss});
+      handles.push_back(handle);
+    }
+  }
+
+  std::vector<std::expected<ely::binding<identifier, int>, ely::lookup_error>>
+      out(ids.size(), std::unexpected(ely::lookup_error::key_not_found));
+  // 3 names in 2 scope sets
+  assert(bm.resolve_all(ids, handles, out) == 6);
+  for (std::size_t i = 0; i != ids.size(); ++i) {
+    auto expected = bm.lookup(ids[i]);
+    assert(out[i].has_value() == expected.has_value());
+    if (expected) {
+      assert(out[i]->value() == expected->value());
+    } else {
+      assert(out[i].error() == expected.error());
+    }
+  }
+  assert(out[0]->value() == 1);
+  assert(out[3]->value() == 0);
+  assert(out[2].error() == ely::lookup_error::key_not_found);
+  assert(bm.resolve_all({}, {}, {}) == 0);
+}
+
+void binding_env_snapshots() {
+  auto arena = ely::arena::growing{};
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+  auto outer = table.make({s0});
+  auto inner = table.make({s0, s1});
+
+  using env_type =
+      ely::binding_env<std::string_view, int, ely::arena::growing>;
+  auto env = env_type(arena);
+  env.insert(table, "x", outer, 0);
+  env.insert(table, "f", outer, 1);
+  auto before = env.snapshot();
+  assert(before.is_same(env));
+
+  // a speculative expansion shadowing x
+  env.insert(table, "x", inner, 2);
+  env.insert(table, "y", inner, 3);
+  assert(env.lookup(table, "x", inner).value() == 2);
+  assert(env.lookup(table, "x", outer).value() == 0);
+  assert(env.lookup(table, "y", inner).value() == 3);
+  assert(env.size() == 3);
+
+  // the snapshot still sees the bindings it was taken with
+  assert(before.lookup(table, "x", inner).value() == 0);
+  assert(before.lookup(table, "y", inner).error() ==
+         ely::lookup_error::key_not_found);
+  assert(before.size() == 2);
+
+  env = before;
+  assert(env.lookup(table, "x", inner).value() == 0);
+  assert(env.lookup(table, "f", ely::scope_set_handle()).error() ==
+         ely::lookup_error::scope_not_found);
+
+  env.insert(table, "f", table.make({s1}), 4);
+  assert(env.lookup(table, "f", inner).error() ==
+         ely::lookup_error::ambiguous);
+
+  // rebinding the same scope set keeps the first binding
+  auto rebound = env.snapshot();
+  assert(!rebound.insert(table, "x", outer, 5));
+  assert(rebound.is_same(env));
+  assert(rebound.lookup(table, "x", inner).value() == 0);
+  assert(rebound.find_bindings("x").size() == 1);
+}
+
+void scope_pool_threads() {
+  auto pool = ely::scope_pool(8);
+  constexpr int thread_count = 4;
+  constexpr int per_thread = 100;
+  std::vector<std::vector<unsigned>> ids(thread_count);
+  {
+    std::vector<std::jthread> threads;
+    for (auto& out : ids) {
+      threads.emplace_back([&pool, &out] {
+        auto gen = pool.make_generator();
+        for (int i = 0; i != per_thread; ++i) {
+          out.push_back(gen().id());
+        }
+      });
+    }
+  }
+
+  std::vector<unsigned> all;
+  for (const auto& out : ids) {
+    assert(std::ranges::is_sorted(out));
+    all.insert(all.end(), out.begin(), out.end());
+  }
+  std::ranges::sort(all);
+  assert(std::ranges::adjacent_find(all) == all.end());
+  assert(all.size() == thread_count * per_thread);
+}
+
+void concurrent_bindings() {
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+  auto outer = ely::scope_set().add_scope(s0);
+  auto inner = outer.add_scope(s1);
+
+  auto bm = ely::concurrent_binding_map<std::string_view, int>();
+  assert(bm.lookup("x", outer).error() == ely::lookup_error::key_not_found);
+  bm.insert("x", outer, 0);
+  assert(bm.lookup("x", inner).value() == 0);
+  assert(bm.lookup("x", ely::scope_set()).error() ==
+         ely::lookup_error::scope_not_found);
+  bm.insert("x", inner, 1);
+  assert(bm.lookup("x", inner).value() == 1);
+  assert(bm.lookup("x", outer).value() == 0);
+  bm.insert("x", ely::scope_set().add_scope(s1), 2);
+  assert(bm.lookup("x", inner).value() == 1);
+  assert(bm.lookup("x", ely::scope_set().add_scope(s1)).value() == 2);
+  // rebinding the same scope set keeps the first binding
+  assert(!bm.insert("x", inner, 3));
+  assert(bm.lookup("x", inner).value() == 1);
+
+  // readers see either no binding or the complete one while two writers add
+  // them, enough for every shard to be compacted under the readers, and by
+  // both writers at once
+  constexpr int symbol_count = 4000;
+  std::vector<std::string> names;
+  for (int i = 0; i != symbol_count; ++i) {
+    names.push_back("sym" + std::to_string(i));
+  }
+  auto name = [&](int i) { return std::string_view(names[i]); };
+  {
+    std::vector<std::jthread> threads;
+    for (int w = 0; w != 2; ++w) {
+      threads.emplace_back([&, w] {
+        for (int i = w; i < symbol_count; i += 2) {
+          bm.insert(name(i), outer, i);
+        }
+      });
+    }
+    for (int t = 0; t != 3; ++t) {
+      threads.emplace_back([&] {
+        int found = 0;
+        while (found != symbol_count) {
+          found = 0;
+          for (int i = 0; i != symbol_count; ++i) {
+            auto res = bm.lookup(name(i), inner);
+            if (res) {
+              assert(*res == i);
+              ++found;
+            } else {
+              assert(res.error() == ely::lookup_error::key_not_found);
+            }
+          }
+        }
+      });
+    }
+  }
+  assert(bm.lookup("x", inner).value() == 1);
 }
 
 void scope() {
+  test_scope<ely::tree_scope_set>();
+  fmt::println("ely/scope/tree - SUCCESS");
   test_scope<ely::scope_set>();
+  scope_set_spill();
   fmt::println("ely/scope/simple - SUCCESS");
+  interned_symbols();
+  fmt::println("ely/scope/interned - SUCCESS");
+  sorted_sets();
+  fmt::println("ely/scope/sorted_set - SUCCESS");
+  scope_table();
+  fmt::println("ely/scope/table - SUCCESS");
+  cached_lookup();
+  fmt::println("ely/scope/cache - SUCCESS");
+  resolve_form();
+  fmt::println("ely/scope/resolve_all - SUCCESS");
+  binding_env_snapshots();
+  fmt::println("ely/scope/env - SUCCESS");
+  scope_pool_threads();
+  concurrent_bindings();
+  fmt::println("ely/scope/concurrent - SUCCESS");
 }
 
 #ifndef NO_MAIN
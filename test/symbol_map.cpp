@@ -0,0 +1,86 @@
+#include <ely/interner.hpp>
+#include <ely/symbol_map.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util.hpp"
+
+void interned_symbols() {
+  auto interner = ely::simple_interner();
+  auto map = ely::symbol_map<int>();
+  auto foo = interner.intern("foo");
+  auto bar = interner.intern("bar");
+  assert(map.empty());
+  assert(map.find(foo) == nullptr);
+
+  map[foo] = 1;
+  assert(map.contains(foo));
+  assert(!map.contains(bar));
+  assert(*map.find(foo) == 1);
+
+  auto [value, inserted] = map.try_emplace(bar, 2);
+  assert(inserted && *value == 2);
+  std::tie(value, inserted) = map.try_emplace(bar, 3);
+  assert(!inserted && *value == 2);
+  assert(map.size() == 2);
+
+  assert(map.erase(foo));
+  assert(!map.erase(foo));
+  assert(!map.contains(foo));
+  // erased values don't come back with the symbol
+  assert(map[foo] == 0);
+}
+
+void sparse_pages() {
+  using map_type = ely::symbol_map<std::string, 16>;
+  auto map = map_type();
+  auto ref = std::unordered_map<ely::symbol::id_type, std::string>();
+
+  // a few clusters of ids far apart, most pages are never touched
+  for (ely::symbol::id_type base : {0u, 1000u, 70000u}) {
+    for (ely::symbol::id_type i = 0; i < 40; i += 3) {
+      auto id = base + i;
+      map[ely::symbol{id}] = std::to_string(id);
+      ref[id] = std::to_string(id);
+    }
+  }
+  assert(map.size() == ref.size());
+  for (ely::symbol::id_type id = 0; id != 70100; ++id) {
+    auto it = ref.find(id);
+    const auto* value = map.find(ely::symbol{id});
+    assert((it == ref.end()) == (value == nullptr));
+    assert(!value || *value == it->second);
+  }
+
+  std::vector<ely::symbol::id_type> seen;
+  std::as_const(map).for_each([&](ely::symbol sym, const std::string& value) {
+    assert(ref.at(sym.id) == value);
+    seen.push_back(sym.id);
+  });
+  assert(seen.size() == ref.size());
+  assert(std::ranges::is_sorted(seen));
+
+  map.clear();
+  assert(map.empty() && !map.contains(ely::symbol{1000}));
+}
+
+void symbol_map() {
+  interned_symbols();
+  fmt::println("ely/symbol_map/interned - SUCCESS");
+  sparse_pages();
+  fmt::println("ely/symbol_map/sparse - SUCCESS");
+}
+
+#ifndef NO_MAIN
+int main() {
+  symbol_map();
+  fmt::println("ely/symbol_map - SUCCESS");
+  return 0;
+}
+#endif
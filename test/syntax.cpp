@@ -0,0 +1,99 @@
+#include <ely/arena/growing.hpp>
+#include <ely/green/parser.hpp>
+#include <ely/interner.hpp>
+#include <ely/scope.hpp>
+#include <ely/stx/token.hpp>
+#include <ely/syntax.hpp>
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// scopes of green nodes are shared by their whole subtree
+void green_syntax() {
+  auto src = std::string("(let ((x 1)) (f x))");
+  src.push_back('\0');
+  auto tokens = ely::stx::tokenize(src);
+  auto interner = ely::simple_interner{};
+  auto arena = ely::arena::growing{};
+  auto l = ely::green::parser(src, tokens, interner, arena).parse_file();
+
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+
+  auto form = ely::syntax::wrap(l[0]);
+  assert(form.is_list());
+  assert(form.size() == 3);
+  assert(form.scope_set() == ely::scope_set_handle());
+
+  auto scoped = form.add_scope(table, s0).flip_scope(table, s1);
+  auto both = table.make({s0, s1});
+  assert(scoped.scope_set() == both);
+  assert(scoped.pending().empty());
+
+  auto body = scoped.child(table, 2);
+  assert(body.scope_set() == both);
+  auto x = body.child(table, 1);
+  assert(x.as_token());
+  assert(x.size() == 0);
+  assert(x.scope_set() == both);
+  assert(x.flip_scope(table, s1).scope_set() == table.make({s0}));
+}
+
+// built lists defer operations on their children until they're inspected
+void built_syntax() {
+  auto arena = ely::arena::growing{};
+  auto table = ely::scope_set_table();
+  auto gen = ely::scope_generator();
+  auto s0 = gen();
+  auto s1 = gen();
+  auto s2 = gen();
+
+  auto leaf = ely::syntax::make_list(arena, {}, table.make({s0}));
+  auto other = ely::syntax::make_list(arena, {}, table.make({s1}));
+  std::vector<ely::syntax> children{leaf, other};
+  auto inner = ely::syntax::make_list(arena, children);
+  std::vector<ely::syntax> outer_children{inner};
+  auto outer = ely::syntax::make_list(arena, outer_children);
+
+  auto rescoped =
+      outer.add_scope(table, s2).flip_scope(table, s0).remove_scope(table, s1);
+  assert(rescoped.scope_set() == table.make({s0, s2}));
+  // s2 is added, s0 flipped and s1 removed for every child
+  assert(rescoped.pending() ==
+         (ely::scope_ops{table.make({s2}), table.make({s1}),
+                         table.make({s0})}));
+  // the stored children are left alone
+  assert(outer.child(table, 0).scope_set() == ely::scope_set_handle());
+
+  auto in = rescoped.child(table, 0);
+  assert(in.scope_set() == table.make({s0, s2}));
+  assert(in.child(table, 0).scope_set() == table.make({s2}));
+  assert(in.child(table, 1).scope_set() == table.make({s0, s2}));
+
+  // flipping twice cancels out, adding after removing adds
+  auto back = rescoped.flip_scope(table, s0).add_scope(table, s1);
+  assert(back.pending() ==
+         (ely::scope_ops{table.make({s1, s2}), {}, {}}));
+  assert(back.child(table, 0).child(table, 0).scope_set() ==
+         table.make({s0, s1, s2}));
+}
+
+void syntax() {
+  green_syntax();
+  fmt::println("ely/syntax/green - SUCCESS");
+  built_syntax();
+  fmt::println("ely/syntax/built - SUCCESS");
+}
+
+#ifndef NO_MAIN
+int main() {
+  syntax();
+  fmt::println("ely/syntax - SUCCESS");
+  return 0;
+}
+#endif